@@ -5,17 +5,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <platform/sios.h>
 #include <platform/module.h>
+#include <platform/stream.h>
 
-#ifdef SIOS_FIXED_POINT
 #include <platform/fixed.h>
-#endif
 
-#define ACCMAG_SYS_BASE		"/sys/class/sensors/sios_accmag"
-#define ACCMAG_MAG_PULSE	"mag_pulse"
+#include "filter.h"
+#include "calibrate.h"
+#include "fft.h"
+#include "gesture.h"
+
 #define ACCMAG_DEV_BASE		"/dev/sios_accmag"
+#define ACCMAG_RATE_PATH	"/sios/sensors/accmag/rate"
+#define ACCMAG_STATUS_PATH	"/sios/sensors/accmag/status"
+#define ACCMAG_UNIT_PATH	"/sios/sensors/accmag/%d/%s/data"
 
 MODULE_INIT(accmag_obj)
 SET_MODULE_VERSION(2,0,1)
@@ -26,226 +32,367 @@ sios_param_string(device_base, device_base, 32);
 int devices = 1;
 sios_param(devices, int, devices);
 
-int calibration_samples = 3;
+/* mag samples fitted per calibration, turn the device all around meanwhile */
+int calibration_samples = 1000;
 sios_param(calibration_samples, int, calibration_samples);
 
+/* calibrations are kept in <dir>/accmag<n>.cal, empty to not keep them */
+static char calibration_dir[128] = "/var/lib/sios";
+sios_param_string(calibration_dir, calibration_dir, 128);
+
+/* only read sensors while their samples are listened to, in shm or
+ * calibrating, 0 to read them all the time */
+int demand = 1;
+sios_param(demand, int, demand);
+
 int verbose = 0;
 sios_param(verbose, int, verbose);
 
+/* filter chains, see filter.h, e.g. "median 5, lowpass 0.25" */
+static char acc_filter[128] = "";
+sios_param_string(acc_filter, acc_filter, 128);
+static char mag_filter[128] = "";
+sios_param_string(mag_filter, mag_filter, 128);
+
+/* publish one sample per decimate reads, see filter.h */
+int decimate = 1;
+sios_param(decimate, int, decimate);
+int decimate_order = 2;
+sios_param(decimate_order, int, decimate_order);
+
+/* publish acc spectra of windows of spectrum_size samples, see fft.h,
+ * 0 for none */
+int spectrum_size = 0;
+sios_param(spectrum_size, int, spectrum_size);
+
+/* acc gestures, see gesture.h: detectors out of "shake tap tilt" and
+ * a file of templates, nothing for none */
+static char gestures[64] = "";
+sios_param_string(gestures, gestures, 64);
+static char gesture_templates[128] = "";
+sios_param_string(gesture_templates, gesture_templates, 128);
+int tap_threshold = 1500;
+sios_param(tap_threshold, int, tap_threshold);
+int shake_threshold = 800;
+sios_param(shake_threshold, int, shake_threshold);
+int motion_threshold = 250;
+sios_param(motion_threshold, int, motion_threshold);
+int tilt_angle = 35;
+sios_param(tilt_angle, int, tilt_angle);
+
+/* also publish the unfiltered samples, on acc_raw and mag_raw */
+int filter_raw = 0;
+sios_param(filter_raw, int, filter_raw);
+
 #define ACCMAG_DATA_SIZE	6
 
 #define AM	0
 #define MM	1
+#define OM	2	/* orientation, fused from both */
+#define RAW	3	/* unfiltered acc and mag, RAW + type */
+#define SP	5	/* acc spectrum */
+#define GE	6	/* acc gestures */
+#define NSTREAMS	7
+
+/* sample rate estimate: running average of the intervals, weight 1/16 */
+#define RATE_FRAC	8
+#define RATE_SHIFT	4
+#define RATE_GAP	1000000	/* usec, longer is a stall, not the rate */
+
+/* 16.16 radians to 16.16 hundredths of a degree */
+#define RAD_TO_CDEG	((mm_fixed_t) 375493621)
 
 struct accmag_data {
 	int16_t x, y, z;
 } __attribute__((packed));
 
 struct accmag_dev {
-	char mag_pulse_path[64];
-	int mag_pulse_state;
 	struct {
-		enum { C_no, C_norm, C_inv } state;
-		int samples, sample;
-		struct accmag_data *norm, *inv;
-		struct accmag_data offset;
-		int first;
+		pthread_mutex_t lock;		/* between the reader and mag/calibrate */
+		enum { C_no, C_run } state;
+		int samples;			/* window of the running fit */
+		struct mag_fit fit;
+		struct mag_calibration cal;	/* applied to every mag sample, reader only */
 	} c_data;
 	int num;
 	int type;
+	struct filter_chain * filter;	/* NULL for none */
+	struct decimator decim;		/* ratio 1 for none */
+	struct spectrum * spectrum;	/* acc only, NULL for none */
+	struct gesture_engine * gesture;	/* acc only, NULL for none */
+	struct accmag_data latest;	/* last corrected sample, for fusion */
+	int fresh;			/* latest was not fused yet */
+	uint64_t stamp;			/* time of the last read, sios_stream_clock() */
+	uint32_t interval;		/* average sample interval, usec << RATE_FRAC */
+	int active;			/* its source is added, under active_lock */
+	struct sios_source_ctx ctx;	/* fd -1 if the sensor did not open */
 };
 
-#define ACCMAG_DEVS(_devs) (signed int)((_devs) ? (sizeof(*(_devs)) / sizeof(struct accmag_dev)) : 0)
-static struct accmag_dev * devs = NULL;
-#define ACCMAG_SOURCES(_ctxs) (signed int)((_ctxs) ? (sizeof(*(_ctxs)) / sizeof(struct sios_source_ctx)) : 0)
-static struct sios_source_ctx * ctxs = NULL;
+/* the streams of a single device, acc, mag and orientation */
+#define UNIT_NSTREAMS	3
 
-LIST_HEAD(am_listen_list);
-LIST_HEAD(mm_listen_list);
-static pthread_mutex_t am_listener_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t mm_listener_lock = PTHREAD_MUTEX_INITIALIZER;
-
-static char * accmag_path[] = { "/sios/sensors/accmag/acc/data", "/sios/sensors/accmag/mag/data" };
+/* one device, an acc and a mag */
+struct accmag_unit {
+	struct accmag_dev sensor[2];	/* AM and MM */
+	struct sios_stream streams[UNIT_NSTREAMS];
+};
 
-static int add_listener(lo_address addr, int type)
-{
-	struct listener * l; 
-	struct list_head * ll;
-	pthread_mutex_t * ll_lock;
+static struct accmag_unit * units = NULL;
+static int nunits = 0;			/* devices at init, the parameter may change */
 
-	if (!addr)
-		return -1;
+/* all devices, records carry the device number */
+static struct sios_stream streams[NSTREAMS];
+/* optional streams are not initialized */
+#define STREAM_USED(_i)	(streams[(_i)].obj != NULL)
 
-	ll = (type) ? &mm_listen_list : &am_listen_list;
-	ll_lock = (type) ? &mm_listener_lock : &am_listener_lock;
+static pthread_mutex_t active_lock = PTHREAD_MUTEX_INITIALIZER;
 
-	pthread_mutex_lock(ll_lock);
+static struct gesture_config gesture_config;
 
-	list_for_each_entry(l, ll, listener) {
-		if (!strcmp(lo_address_get_hostname(addr), lo_address_get_hostname(l->address)) &&
-				!strcmp(lo_address_get_port(addr), lo_address_get_port(l->address))) {
-			info(MODULE_NAME, "accmag: %s:%s already a listener", 
-					lo_address_get_hostname(addr),
-					lo_address_get_port(addr));
-			pthread_mutex_unlock(ll_lock);
-			return -1;
-		}
-	}
+static char * accmag_sub[] = { "acc", "mag", "orientation", "acc_raw", "mag_raw", "spectrum",
+			       "gesture" };
+static char * accmag_path[] = { "/sios/sensors/accmag/acc/data", "/sios/sensors/accmag/mag/data",
+				"/sios/sensors/accmag/orientation/data",
+				"/sios/sensors/accmag/acc_raw/data", "/sios/sensors/accmag/mag_raw/data",
+				"/sios/sensors/accmag/spectrum/data", "/sios/sensors/accmag/gesture/data" };
 
-	l = (struct listener*)malloc(sizeof(struct listener));
-	if (!l) {
-		pthread_mutex_unlock(ll_lock);
-		return -1;
-	}
+static int accmag_encode(struct sios_stream * stream, const void * record,
+			 const struct sios_stream_sample * sample,
+			 enum sios_stream_format format, lo_message msg)
+{
+	const struct sios_shm_accmag * r = (const struct sios_shm_accmag*)record;
 
-	INIT_LIST_HEAD(&l->listener);
-	l->address = addr;
-	list_add(&l->listener, ll);
+	lo_message_add_int32(msg, r->dev);
+	lo_message_add_int32(msg, (int)r->x);
+	lo_message_add_int32(msg, (int)r->y);
+	lo_message_add_int32(msg, (int)r->z);
+	return 0;
+}
 
-	pthread_mutex_unlock(ll_lock);
+static int orientation_encode(struct sios_stream * stream, const void * record,
+			      const struct sios_stream_sample * sample,
+			      enum sios_stream_format format, lo_message msg)
+{
+	const struct sios_shm_orientation * r = (const struct sios_shm_orientation*)record;
 
-	info(MODULE_NAME, "sending %s data to: %s:%s", (type) ? "magnetometer" : "accelerometer", 
-							 lo_address_get_hostname(addr), 
-						   	 lo_address_get_port(addr));
+	lo_message_add_int32(msg, r->dev);
+	lo_message_add_int32(msg, r->roll);
+	lo_message_add_int32(msg, r->pitch);
+	lo_message_add_int32(msg, r->heading);
 	return 0;
 }
 
-static void del_listener(lo_address addr, int type)
+static int spectrum_encode(struct sios_stream * stream, const void * record,
+			   const struct sios_stream_sample * sample,
+			   enum sios_stream_format format, lo_message msg)
 {
-	struct listener * l; 
-	pthread_mutex_t * ll_lock;
-	int found = 0;
-
-	if (!addr) return;
+	const struct sios_shm_spectrum * r = (const struct sios_shm_spectrum*)record;
+	int i;
 
-	ll_lock = (type) ? &mm_listener_lock : &am_listener_lock;
+	lo_message_add_int32(msg, r->dev);
+	lo_message_add_int32(msg, (int32_t)r->peak);
+	for (i=0;i<SIOS_SPECTRUM_BANDS;i++)
+		lo_message_add_int32(msg, (int32_t)r->band[i]);
+	return 0;
+}
 
-	pthread_mutex_lock(ll_lock);
+static int gesture_encode(struct sios_stream * stream, const void * record,
+			  const struct sios_stream_sample * sample,
+			  enum sios_stream_format format, lo_message msg)
+{
+	const struct sios_shm_gesture * r = (const struct sios_shm_gesture*)record;
 
-	list_for_each_entry(l, (type) ? &mm_listen_list : &am_listen_list, listener) {
-		if (!strcmp(lo_address_get_hostname(addr), lo_address_get_hostname(l->address)) &&
-				!strcmp(lo_address_get_port(addr), lo_address_get_port(l->address))) {
-			found = 1;
-			break;
-		}
-	}
+	lo_message_add_string(msg, r->name);
+	lo_message_add_int32(msg, r->dev);
+	return 0;
+}
 
-	if (found) {
-		info(MODULE_NAME, "stop sending %s data to: %s:%s", (type) ? "magnetometer" : "accelerometer", 
-								      lo_address_get_hostname(l->address), 
-								      lo_address_get_port(l->address));
-		list_del(&l->listener);
-		lo_address_free(l->address);
-		free(l);
-	}
+/* publish on the stream of all devices and on the device's own */
+static inline void accmag_publish(struct accmag_unit * unit, int i, const void * record,
+				  uint64_t stamp)
+{
+	sios_stream_publish_at(&streams[i], record, stamp);
+	sios_stream_publish_at(&unit->streams[i], record, stamp);
+}
 
-	pthread_mutex_unlock(ll_lock);
+static inline int32_t rad_to_cdeg(mm_fixed_t rad)
+{
+	return fintpart(fmulff(rad, RAD_TO_CDEG) + (MM_FIXED_ONE >> 1));
 }
 
-static int del_acc_listen_source_handler(const char *path, const char *types, lo_arg **argv, 
-			      int argc, lo_message msg, void *user_data)
+/*
+ * Roll, pitch and tilt compensated heading of a device once it has fresh
+ * acc and mag samples, all in fixed point:
+ *
+ *	roll = atan2(ay, az)
+ *	pitch = atan2(-ax, ay sin(roll) + az cos(roll))
+ *	heading = atan2(my cos(roll) - mz sin(roll),
+ *			mx cos(pitch) + (my sin(roll) + mz cos(roll)) sin(pitch))
+ *
+ * Both sensors are assumed to share their axes.
+ */
+static void accmag_fuse(int num, uint64_t stamp)
 {
-	lo_address addr, t = lo_message_get_source(msg);
+	struct accmag_unit * unit = &units[num];
+	struct accmag_dev * acc = &unit->sensor[AM], * mag = &unit->sensor[MM];
+	struct sios_shm_orientation record;
+	mm_fixed_t ax, ay, az, mx, my, mz;
+	mm_fixed_t roll, pitch, heading, sr, cr, sp, cp;
+
+	if (!acc->fresh || !mag->fresh)
+		return;
+	acc->fresh = mag->fresh = 0;
+
+	/* 8 fraction bits keep the products exact and clear of overflow */
+	ax = acc->latest.x * 256; ay = acc->latest.y * 256; az = acc->latest.z * 256;
+	mx = mag->latest.x * 256; my = mag->latest.y * 256; mz = mag->latest.z * 256;
+
+	roll = fatan2(ay, az);
+	fsincos(roll, &sr, &cr);
+	pitch = fatan2(-ax, fmulff(ay, sr) + fmulff(az, cr));
+	fsincos(pitch, &sp, &cp);
+	heading = fatan2(fmulff(my, cr) - fmulff(mz, sr),
+			 fmulff(mx, cp) + fmulff(fmulff(my, sr) + fmulff(mz, cr), sp));
+
+	record.dev = num;
+	record.roll = rad_to_cdeg(roll);
+	record.pitch = rad_to_cdeg(pitch);
+	/* a full turn would overflow 16.16 hundredths of a degree */
+	record.heading = rad_to_cdeg(heading);
+	if (record.heading < 0)
+		record.heading += 36000;
+	if (record.heading >= 36000)
+		record.heading -= 36000;
+	accmag_publish(unit, OM, &record, stamp);
+}
 
-	if (argc < 2) {
-		info(MODULE_NAME, "delling from source");
-		addr = lo_address_new(lo_address_get_hostname(t), lo_address_get_port(t));
-	} else {
-		info(MODULE_NAME, "delling from args %s", types);
-		if (types[1] == 'i') {
-			char port[6];
-			snprintf(port, 6, "%d", argv[1]->i);
-			addr = lo_address_new(&argv[0]->s, port);
-		} else {
-			addr = lo_address_new(&argv[0]->s, &argv[1]->s);
-		}
-	}
+/* tell if anything consumes the samples of a sensor, not locked */
+static int dev_wanted(struct accmag_dev * dev)
+{
+	struct accmag_unit * unit = &units[dev->num];
+
+	if (!demand)
+		return 1;
+	if (dev->type && dev->c_data.state == C_run)
+		return 1;
+	if (sios_stream_active(&streams[dev->type]) || sios_stream_active(&streams[OM]))
+		return 1;
+	if (sios_stream_active(&unit->streams[dev->type]) || sios_stream_active(&unit->streams[OM]))
+		return 1;
+	if (dev->spectrum && sios_stream_active(&streams[SP]))
+		return 1;
+	if (dev->gesture && sios_stream_active(&streams[GE]))
+		return 1;
+	return STREAM_USED(RAW) && sios_stream_active(&streams[RAW + dev->type]);
+}
 
-	del_listener(addr, AM);
-	lo_address_free(addr);
-	return 0;
+/*
+ * Add the source of a sensor if it is idle. The reader removes it again,
+ * see dev_idle(), the lock orders the two.
+ */
+static void dev_activate(struct accmag_dev * dev)
+{
+	int start;
+
+	if (dev->ctx.fd < 0)
+		return;
+
+	pthread_mutex_lock(&active_lock);
+	start = !dev->active;
+	dev->active = 1;
+	pthread_mutex_unlock(&active_lock);
+	if (!start)
+		return;
+
+	/* history from before the pause would only disturb */
+	if (dev->filter)
+		filter_chain_reset(dev->filter);
+	decimator_reset(&dev->decim);
+	if (dev->spectrum)
+		spectrum_reset(dev->spectrum);
+	if (dev->gesture)
+		gesture_engine_reset(dev->gesture);
+	dev->fresh = 0;
+	dev->stamp = 0;
+
+	if (sios_add_source_ctx(&dev->ctx))
+		err(MODULE_NAME, "could not start %s %d", dev->type ? "mag" : "acc", dev->num);
+	else if (demand)
+		info(MODULE_NAME, "%s %d active", dev->type ? "mag" : "acc", dev->num);
 }
 
-static int del_mag_listen_source_handler(const char *path, const char *types, lo_arg **argv, 
-			      int argc, lo_message msg, void *user_data)
+/*
+ * Called by the reader, a sensor nobody wants goes idle by returning 1
+ * from its handler, which removes its source.
+ */
+static int dev_idle(struct accmag_dev * dev)
 {
-	lo_address addr, t = lo_message_get_source(msg);
+	int idle;
 
-	if (argc < 2) {
-		info(MODULE_NAME, "delling from source");
-		addr = lo_address_new(lo_address_get_hostname(t), lo_address_get_port(t));
-	} else {
-		info(MODULE_NAME, "delling from args %s", types);
-		if (types[1] == 'i') {
-			char port[6];
-			snprintf(port, 6, "%d", argv[1]->i);
-			addr = lo_address_new(&argv[0]->s, port);
-		} else {
-			addr = lo_address_new(&argv[0]->s, &argv[1]->s);
-		}
-	}
+	if (dev_wanted(dev))
+		return 0;
 
-	del_listener(addr, MM);
-	lo_address_free(addr);
-	return 0;
+	pthread_mutex_lock(&active_lock);
+	idle = !dev_wanted(dev);
+	if (idle)
+		dev->active = 0;
+	pthread_mutex_unlock(&active_lock);
+
+	if (idle)
+		info(MODULE_NAME, "%s %d idle", dev->type ? "mag" : "acc", dev->num);
+	return idle;
 }
 
-static int add_acc_listen_source_handler(const char *path, const char *types, lo_arg **argv, 
-			      int argc, lo_message msg, void *user_data)
+/*
+ * Stream wake callback, a listen or shm request may want idle sensors.
+ * The streams of a device have it in priv and only wake its sensors.
+ */
+static void accmag_wake(struct sios_stream * stream)
 {
-	lo_address addr, t = lo_message_get_source(msg);
-
-	if (argc < 2) {
-		info(MODULE_NAME, "adding from source");
-		addr = lo_address_new(lo_address_get_hostname(t), lo_address_get_port(t));
-	} else {
-		info(MODULE_NAME, "adding from args %s", types);
-		if (types[1] == 'i') {
-			char port[6];
-			snprintf(port, 6, "%d", argv[1]->i);
-			addr = lo_address_new(&argv[0]->s, port);
-		} else {
-			addr = lo_address_new(&argv[0]->s, &argv[1]->s);
-		}
-	}
+	struct accmag_unit * unit = (struct accmag_unit*)stream->priv;
+	int i, t;
 
-	if (add_listener(addr, AM)) {
-		lo_address_free(addr);
-		return -1;
+	for (i=0;i<nunits;i++) {
+		if (unit && unit != &units[i])
+			continue;
+		for (t=AM;t<=MM;t++)
+			if (dev_wanted(&units[i].sensor[t]))
+				dev_activate(&units[i].sensor[t]);
 	}
-
-	return 0;
 }
 
-static int add_mag_listen_source_handler(const char *path, const char *types, lo_arg **argv, 
-			      int argc, lo_message msg, void *user_data)
+static int dev_accmag_calibrate_mag(int devnum, int samples)
 {
-	lo_address addr, t = lo_message_get_source(msg);
+	struct accmag_dev * dev;
 
-	if (argc < 2) {
-		info(MODULE_NAME, "adding from source");
-		addr = lo_address_new(lo_address_get_hostname(t), lo_address_get_port(t));
-	} else {
-		info(MODULE_NAME, "adding from args %s", types);
-		if (types[1] == 'i') {
-			char port[6];
-			snprintf(port, 6, "%d", argv[1]->i);
-			addr = lo_address_new(&argv[0]->s, port);
-		} else {
-			addr = lo_address_new(&argv[0]->s, &argv[1]->s);
-		}
+	if (devnum < 0 || devnum >= nunits || units[devnum].sensor[MM].ctx.fd < 0) {
+		warn(MODULE_NAME, "no magnetometer %d to calibrate", devnum);
+		return -1;
+	}
+	dev = &units[devnum].sensor[MM];
+
+	if (samples < MAG_FIT_MIN_SAMPLES) {
+		warn(MODULE_NAME, "calibrating with %d samples instead of %d", MAG_FIT_MIN_SAMPLES, samples);
+		samples = MAG_FIT_MIN_SAMPLES;
 	}
 
-	if (add_listener(addr, MM)) {
-		lo_address_free(addr);
+	pthread_mutex_lock(&dev->c_data.lock);
+	if (dev->c_data.state != C_no) {
+		pthread_mutex_unlock(&dev->c_data.lock);
+		warn(MODULE_NAME, "accmag already in callibration sequence");
 		return -1;
 	}
+	mag_fit_reset(&dev->c_data.fit);
+	dev->c_data.samples = samples;
+	dev->c_data.state = C_run;
+	pthread_mutex_unlock(&dev->c_data.lock);
+
+	info(MODULE_NAME, "calibrating mag %d over %d samples", devnum, samples);
+	dev_activate(dev);
 
 	return 0;
 }
 
-static int dev_accmag_calibrate_mag(int devnum, int samples);
-
 static int mag_calibrate_handler (const char *path, const char *types, lo_arg **argv, 
 			      int argc, lo_message msg, void *user_data)
 {
@@ -258,144 +405,115 @@ static int mag_calibrate_handler (const char *path, const char *types, lo_arg **
 		samples = calibration_samples;
 	dev = argv[0]->i;
 
-	if (dev >= 0 && samples > 0) {
-		info(MODULE_NAME, "calibration request %d, %d", dev, samples);
+	if (dev >= 0 && samples > 0)
 		dev_accmag_calibrate_mag(dev, samples);
-	}
+	return 0;
 }
 
-static int dev_accmag_toggle_magpulse(int devnum)
+static int calibration_file(char * file, size_t size, int num)
 {
-	struct accmag_dev * dev = &devs[devnum];
-	int fd, n;
-	char toggle[3];
-
-	dev->mag_pulse_state = !dev->mag_pulse_state;
-
-	info(MODULE_NAME, "accmag toggling mag_pulse %s (%d, %d)", dev->mag_pulse_path, devnum, dev->mag_pulse_state);
-	fd = open(dev->mag_pulse_path, O_WRONLY | O_NONBLOCK);
-	if (fd < 0) {
-		err(MODULE_NAME, "error opening 'dev': %s", strerror(errno));
-		return -1;
-	}
-	
-	n = snprintf(toggle, 3, "%d", dev->mag_pulse_state);
-	write(fd, toggle, 3);
-	close(fd);
-
-	if (n < 3)
+	if (!calibration_dir[0])
 		return -1;
-	return 0;
+	return snprintf(file, size, "%s/accmag%d.cal", calibration_dir, num) < (int)size ? 0 : -1;
 }
 
-static void dev_mag_calc_offset(struct accmag_dev *dev) 
+/*
+ * Add a raw sample to the running fit, installs the new calibration once
+ * the window is full. The current one stays in use until then. A new
+ * mag/calibrate can only start once the fit is solved and installed.
+ */
+static void dev_mag_calibrate_sample(struct accmag_dev * dev, const struct accmag_data * data)
 {
-	struct {signed int x; signed int y; signed int z;} avg_n = {0, 0, 0}, avg_i = {0, 0, 0};
-	struct accmag_data act = {0, 0, 0};	
-	int i;
-#ifdef SIOS_FIXED_POINT
-	mm_fixed_t tmp_x, tmp_y, tmp_z;
-#endif
+	struct mag_calibration cal;
+	char file[192];
+	int failed;
+
+	pthread_mutex_lock(&dev->c_data.lock);
+	if (dev->c_data.state != C_run) {
+		pthread_mutex_unlock(&dev->c_data.lock);
+		return;
+	}
+	mag_fit_add(&dev->c_data.fit, data->x, data->y, data->z);
+	if (dev->c_data.fit.samples < dev->c_data.samples) {
+		pthread_mutex_unlock(&dev->c_data.lock);
+		return;
+	}
 
-	info(MODULE_NAME, "accmag calculating offsets");
-	
-	for (i=0;i<dev->c_data.samples;i++) {
-		info(MODULE_NAME, "norm: [0x%x, 0x%x, 0x%x], inv: [0x%x, 0x%x, 0x%x]", 
-				dev->c_data.norm[i].x, dev->c_data.norm[i].y, dev->c_data.norm[i].z,
-				dev->c_data.inv[i].x, dev->c_data.inv[i].y, dev->c_data.inv[i].z);
-		avg_n.x += dev->c_data.norm[i].x; avg_n.y += dev->c_data.norm[i].y; avg_n.z += dev->c_data.norm[i].z;
-		avg_i.x += dev->c_data.inv[i].x; avg_i.y += dev->c_data.inv[i].y; avg_i.z += dev->c_data.inv[i].z;
-		info(MODULE_NAME, "avg norm: [0x%x, 0x%x, 0x%x], inv: [0x%x, 0x%x, 0x%x]", 
-				avg_n.x, avg_n.y, avg_n.z,
-				avg_i.x, avg_i.y, avg_i.z);
+	failed = mag_fit_solve(&dev->c_data.fit, &cal);
+	if (!failed)
+		dev->c_data.cal = cal;
+	dev->c_data.state = C_no;
+	pthread_mutex_unlock(&dev->c_data.lock);
 
+	if (failed) {
+		warn(MODULE_NAME, "mag %d calibration failed, turn the device around more", dev->num);
+		return;
 	}
-	avg_n.x /= dev->c_data.samples; avg_n.y /= dev->c_data.samples; avg_n.z /= dev->c_data.samples;
-	avg_i.x /= dev->c_data.samples; avg_i.y /= dev->c_data.samples; avg_i.z /= dev->c_data.samples;
-
-#ifdef SIOS_FIXED_POINT
-	tmp_x = fdivff(itofix(avg_n.x - avg_i.x), itofix(2));
-	tmp_y = fdivff(itofix(avg_n.y - avg_i.y), itofix(2));
-	tmp_z = fdivff(itofix(avg_n.z - avg_i.z), itofix(2));
-
-	act.x = fixtoi(tmp_x);
-	act.y = fixtoi(tmp_y);
-	act.z = fixtoi(tmp_z);
-#else
-	act.x = (int)((float)(avg_n.x - avg_i.x) / 2.0);
-	act.y = (int)((float)(avg_n.y - avg_i.y) / 2.0);
-	act.z = (int)((float)(avg_n.z - avg_i.z) / 2.0);
-#endif
-
-	dev->c_data.offset.x = act.x - avg_n.x;
-	dev->c_data.offset.y = act.y - avg_n.y;
-	dev->c_data.offset.z = act.z - avg_n.z;
-	info(MODULE_NAME, "accmag have offsets (%d, %d, %d)", 
-			dev->c_data.offset.x,
-			dev->c_data.offset.y,
-			dev->c_data.offset.z);
+
+	if (dev->filter)
+		filter_chain_reset(dev->filter);
+	decimator_reset(&dev->decim);
+	info(MODULE_NAME, "mag %d calibrated, offset (%d, %d, %d)", dev->num,
+	     cal.offset[0], cal.offset[1], cal.offset[2]);
+
+	if (!calibration_file(file, sizeof(file), dev->num) && mag_calibration_save(file, &cal))
+		warn(MODULE_NAME, "could not store calibration in %s: %s", file, strerror(errno));
 }
 
-static int dev_accmag_calibrate_mag(int devnum, int samples)
+/*
+ * Use the stored calibration of every mag, before its first sample.
+ */
+static void load_calibrations(void)
 {
-	struct accmag_dev * dev = &devs[devnum+1];
+	char file[192];
+	int i;
 
-	info(MODULE_NAME, "initialize calibration: %d, %d", devnum, samples );
-	if (dev->c_data.state != C_no) {
-		warn(MODULE_NAME, "accmag already in callibration sequence");
-		return -1;
-	}
-	
-	if (dev->c_data.samples == samples) {
-		if (dev->c_data.norm != NULL && dev->c_data.inv != NULL) {
-			/* reset callibration samples */
-			memset(dev->c_data.norm, 0x0, sizeof(*dev->c_data.norm) * samples);
-			memset(dev->c_data.inv, 0x0, sizeof(*dev->c_data.inv) * samples);
-		} else {
-			/* resize callibration sample space */
-			free(dev->c_data.norm);
-			free(dev->c_data.inv);
-			dev->c_data.norm = (struct accmag_data*)malloc(sizeof(struct accmag_data)*samples);
-			dev->c_data.inv = (struct accmag_data*)malloc(sizeof(struct accmag_data)*samples);
-
-			
-		}
-	} else {
-		free(dev->c_data.norm);
-		free(dev->c_data.inv);
-		dev->c_data.norm = (struct accmag_data*)malloc(sizeof(struct accmag_data)*samples);
-		dev->c_data.inv = (struct accmag_data*)malloc(sizeof(struct accmag_data)*samples);
+	for (i=0;i<nunits;i++) {
+		if (units[i].sensor[MM].ctx.fd < 0 || calibration_file(file, sizeof(file), i))
+			continue;
+		if (!mag_calibration_load(file, &units[i].sensor[MM].c_data.cal))
+			info(MODULE_NAME, "mag %d calibration loaded from %s", i, file);
+		else if (errno != ENOENT)
+			warn(MODULE_NAME, "ignoring calibration %s: %s", file, strerror(errno));
+		else
+			info(MODULE_NAME, "mag %d is not calibrated, see mag/calibrate", i);
 	}
+}
 
-	if (!dev->c_data.norm || !dev->c_data.inv) {
-		info(MODULE_NAME, "accmag could not allocate sample space");
-		free(dev->c_data.norm);
-		free(dev->c_data.inv);
-		return -1;
-	}
+static void dev_rate_update(struct accmag_dev * dev, uint64_t stamp)
+{
+	uint64_t last = dev->stamp, dt = stamp - last;
+
+	dev->stamp = stamp;
+	if (!last || dt > RATE_GAP)
+		return;
+	if (!dev->interval)
+		dev->interval = (uint32_t)(dt << RATE_FRAC);
+	else
+		dev->interval += ((int32_t)(dt << RATE_FRAC) - (int32_t)dev->interval) >> RATE_SHIFT;
+}
 
-	dev->c_data.state = C_norm;
-	dev->c_data.samples = samples;
-	dev->c_data.sample = 0;
-	dev->c_data.offset.x = 0;
-	dev->c_data.offset.y = 0;
-	dev->c_data.offset.z = 0;
+/* samples per second, 0 until two samples came in */
+static float dev_rate(struct accmag_dev * dev)
+{
+	uint32_t interval = dev->interval;
 
-	return 0;
+	return interval ? (float)(1e6 * (1 << RATE_FRAC) / interval) : 0.0f;
 }
 
 static int dev_accmag_read(struct sios_source_ctx * ctx, enum sios_event_type action) 
 {
-	struct listener * l;
-	struct list_head * ll;
 	struct accmag_dev * dev = (struct accmag_dev*)ctx->priv;
+	struct accmag_unit * unit = &units[dev->num];
 	struct accmag_data data;
+	uint64_t stamp;
 	int bytes;
 
 	if (action != SIOS_EVENT_READ)
 		return 0;
 	
 	bytes = read(ctx->fd, (char*)&data, ACCMAG_DATA_SIZE);
+	stamp = sios_stream_clock();
 	if (bytes < ACCMAG_DATA_SIZE) {
 		if (bytes < 0) 
 			err(MODULE_NAME, "accmag read error (%d): %s", bytes, strerror(bytes));
@@ -403,68 +521,68 @@ static int dev_accmag_read(struct sios_source_ctx * ctx, enum sios_event_type ac
 			warn(MODULE_NAME, "accmag read only %d bytes, ignoring", bytes);
 		return 0;
 	} else {
-		if (dev->type && dev->c_data.state != C_no) {
-			info(MODULE_NAME, "accmag capturing calibration samples (%d,%d)", dev->type, dev->c_data.state);
-			if (dev->c_data.state == C_norm) {
-				info(MODULE_NAME, "getting normal sample %d", dev->c_data.sample + 1);
-				memcpy(&dev->c_data.norm[dev->c_data.sample], &data, sizeof(data));
-				if (++dev->c_data.sample == dev->c_data.samples) {
-					info(MODULE_NAME, "accmag captured enough norm samples");
-					dev->c_data.state = C_inv;
-					dev->c_data.sample = 0;
-					dev->c_data.first = 1;
-					dev_accmag_toggle_magpulse(dev->num);
-				}
-			} else if (dev->c_data.state == C_inv) {
-				if (dev->c_data.first) {
-					info(MODULE_NAME, "accmag skipping first inv sample");
-					dev->c_data.first = 0;
-				} else {
-					info(MODULE_NAME, "getting invert sample %d", dev->c_data.sample + 1);
-					memcpy(&dev->c_data.inv[dev->c_data.sample], &data, sizeof(data));
-					if (++dev->c_data.sample == dev->c_data.samples) {
-						info(MODULE_NAME, "accmag captured enough inv samples");
-						dev->c_data.state = C_no;
-						dev_accmag_toggle_magpulse(dev->num);
-						dev_mag_calc_offset(dev);
-					}
-				}
-			}
-		} else {
-			pthread_mutex_t * ll_lock;
+		struct sios_shm_accmag record;
 
-			if (dev->type) {
-				data.x += dev->c_data.offset.x;
-				data.y += dev->c_data.offset.y;
-				data.z += dev->c_data.offset.z;
-			}
+		if (dev_idle(dev))
+			return 1;
 
-			ll = (dev->type) ? &mm_listen_list : &am_listen_list;
-			ll_lock = (dev->type) ? &mm_listener_lock : &am_listener_lock;
-
-			pthread_mutex_lock(ll_lock);
-
-			if (!list_empty(ll)) {
-				lo_message msg = lo_message_new();
-				lo_message_add_int32(msg, dev->num);
-				lo_message_add_int32(msg, (int)data.x);
-				lo_message_add_int32(msg, (int)data.y);
-				lo_message_add_int32(msg, (int)data.z);
-				list_for_each_entry(l, ll, listener) {
-					sios_osc_dispatch_msg(l->address, 
-							      accmag_path[dev->type],
-							      msg);
-				}
-				lo_message_free(msg);
-				if (verbose)
-					info(MODULE_NAME, "%s data: %d\t%d\t%d", 
-							  (dev->type) ? "mag" : "acc", 
-							  (int)data.x, (int)data.y, (int)data.z);
-			}
+		dev_rate_update(dev, stamp);
+		/* unlocked hint, dev_mag_calibrate_sample() checks again */
+		if (dev->type && dev->c_data.state == C_run)
+			dev_mag_calibrate_sample(dev, &data);
+
+		/* at the full rate, before decimation and filters */
+		if (dev->spectrum) {
+			struct sios_shm_spectrum spectrum;
 
-			pthread_mutex_unlock(ll_lock);
+			if (spectrum_run(dev->spectrum, data.x, data.y, data.z, dev_rate(dev), &spectrum)) {
+				spectrum.dev = dev->num;
+				sios_stream_publish_at(&streams[SP], &spectrum, stamp);
+			}
+		}
 
+		/* always published, the stream keeps the latest value */
+		record.dev = dev->num;
+		record.x = data.x;
+		record.y = data.y;
+		record.z = data.z;
+		record.pad = 0;
+		if (dev->type)
+			mag_calibration_apply(&dev->c_data.cal, &record.x, &record.y, &record.z);
+		if (dev->decim.ratio > 1) {
+			if (!decimator_run(&dev->decim, &record.x, &record.y, &record.z))
+				return 0;
+			/* the decimated sample is centered on its window */
+			stamp -= ((uint64_t)decimator_delay2(&dev->decim) * dev->interval) >> (RATE_FRAC + 1);
+		}
+		if (dev->filter) {
+			if (filter_raw)
+				sios_stream_publish_at(&streams[RAW + dev->type], &record, stamp);
+			filter_chain_run(dev->filter, &record.x, &record.y, &record.z);
+		}
+		data.x = record.x;
+		data.y = record.y;
+		data.z = record.z;
+		accmag_publish(unit, dev->type, &record, stamp);
+		if (dev->gesture) {
+			struct sios_shm_gesture gesture;
+			const char * name = gesture_run(dev->gesture, data.x, data.y, data.z, stamp);
+
+			if (name) {
+				gesture.dev = dev->num;
+				snprintf(gesture.name, SIOS_GESTURE_NAMESIZE, "%s", name);
+				sios_stream_publish_at(&streams[GE], &gesture, stamp);
+			}
 		}
+		if (verbose && (sios_stream_active(&streams[dev->type]) ||
+				sios_stream_active(&unit->streams[dev->type])))
+			info(MODULE_NAME, "%s data: %d\t%d\t%d", 
+					  (dev->type) ? "mag" : "acc", 
+					  (int)data.x, (int)data.y, (int)data.z);
+
+		dev->latest = data;
+		dev->fresh = 1;
+		accmag_fuse(dev->num, stamp);
 	}
 	return 0;
 }
@@ -479,99 +597,333 @@ static int open_accmag_dev(const char * dev)
 	return fd;
 }
 
+/* the gesture parameters, before the devices get their engines */
+static void init_gestures(void)
+{
+	char error[128];
+	int detectors = gesture_detectors(gestures), n;
+
+	memset(&gesture_config, 0, sizeof(gesture_config));
+	if (detectors < 0) {
+		err(MODULE_NAME, "invalid gestures '%s', known are shake, tap and tilt", gestures);
+		detectors = 0;
+	}
+	gesture_config.detectors = detectors;
+	gesture_config.tap_threshold = tap_threshold;
+	gesture_config.shake_threshold = shake_threshold;
+	gesture_config.motion_threshold = motion_threshold;
+	gesture_config.tilt_angle = tilt_angle;
+
+	if (gesture_templates[0]) {
+		n = gesture_templates_load(&gesture_config, gesture_templates, error, sizeof(error));
+		if (n < 0)
+			err(MODULE_NAME, "gesture templates: %s", error);
+		else
+			info(MODULE_NAME, "loaded %d gesture templates from %s", n, gesture_templates);
+	}
+	if (gesture_config.detectors || gesture_config.templates)
+		info(MODULE_NAME, "recognizing gestures '%s'", gestures);
+}
+
 static int init_devices(int num) 
 {
 	int i, retval = 0;
 	
 	if (num <= 0) return -1;
 
-	ctxs = (struct sios_source_ctx*)malloc(sizeof(struct sios_source_ctx) * num * 2);
-	if (ctxs == NULL) return -1;
-
-	devs = (struct accmag_dev*)malloc(sizeof(struct accmag_dev) * num * 2);
-	if (devs == NULL) return -1;
+	units = (struct accmag_unit*)calloc(num, sizeof(struct accmag_unit));
+	if (units == NULL) return -1;
+	nunits = num;
 	
 	for (i=0;i<num*2;i++) {
+		struct accmag_dev * dev = &units[i/2].sensor[i%2];
 		char name[40];
 		int num = i/2;
 		int type = i%2;
 		int fd;
 
+		dev->num = num;
+		dev->type = type;
+		pthread_mutex_init(&dev->c_data.lock, NULL);
+
 		snprintf(name, 40, "%s%d%c", device_base, num, (type) ? 'm' : 'a' );
 		info(MODULE_NAME, "openening %s dev: %s", (type) ? "mag" : "acc", name);
 		
 		fd = open_accmag_dev(name);	
 		if (fd < 0) {
-			ctxs[i].fd = -1;
+			dev->ctx.fd = -1;
 			retval++;
 			continue;
 		}
 
-		snprintf(devs[i].mag_pulse_path, 64, "%s%dm/%s", ACCMAG_SYS_BASE, num, ACCMAG_MAG_PULSE);
-		devs[i].mag_pulse_state = 0;
-		devs[i].num = num;
-		devs[i].type = type;
-		devs[i].c_data.state = C_no;
-		devs[i].c_data.samples = 0;
-		devs[i].c_data.sample = 0;
-		devs[i].c_data.offset.x = 0;
-		devs[i].c_data.offset.y = 0;
-		devs[i].c_data.offset.z = 0;
+		dev->c_data.state = C_no;
+		dev->c_data.samples = 0;
+		mag_calibration_identity(&dev->c_data.cal);
+		dev->fresh = 0;
+		dev->filter = filter_chain_parse(type ? mag_filter : acc_filter);
+		if (decimator_init(&dev->decim, decimate, decimate_order)) {
+			if (!i)
+				warn(MODULE_NAME, "invalid decimation %d order %d, not decimating",
+				     decimate, decimate_order);
+			decimator_init(&dev->decim, 1, 1);
+		} else if (decimate > 1 && !i) {
+			info(MODULE_NAME, "decimating by %d, order %d", decimate, decimate_order);
+		}
+		if (spectrum_size && !type) {
+			dev->spectrum = (struct spectrum*)malloc(sizeof(struct spectrum));
+			if (!dev->spectrum || spectrum_init(dev->spectrum, spectrum_size)) {
+				err(MODULE_NAME, "invalid spectrum size %d, need a power of two %d..%d",
+				    spectrum_size, FFT_MIN_SIZE, FFT_MAX_SIZE);
+				free(dev->spectrum);
+				dev->spectrum = NULL;
+			}
+		}
+		if ((gesture_config.detectors || gesture_config.templates) && !type) {
+			dev->gesture = (struct gesture_engine*)malloc(sizeof(struct gesture_engine));
+			if (!dev->gesture || gesture_engine_init(dev->gesture, &gesture_config)) {
+				err(MODULE_NAME, "out of memory for the gestures of acc %d", num);
+				free(dev->gesture);
+				dev->gesture = NULL;
+			}
+		}
+		if (dev->filter && !i)
+			info(MODULE_NAME, "filtering acc: '%s'", acc_filter);
+		else if (dev->filter && i == 1)
+			info(MODULE_NAME, "filtering mag: '%s'", mag_filter);
 	
-		ctxs[i].self = THIS_MODULE;
-		ctxs[i].type = SIOS_POLL_READ;
-		ctxs[i].priority = SIOS_PRIORITY_DEFAULT;
-		ctxs[i].handler = dev_accmag_read;
-		ctxs[i].fd = fd;
-		ctxs[i].priv = &devs[i];
+		dev->ctx.self = THIS_MODULE;
+		dev->ctx.type = SIOS_POLL_READ;
+		dev->ctx.priority = SIOS_PRIORITY_DEFAULT;
+		dev->ctx.handler = dev_accmag_read;
+		dev->ctx.fd = fd;
+		dev->ctx.priv = dev;
 	}
 
 	return retval;
 }
 
+/*
+ * Remove the sources of all sensors, then the streams they publish on,
+ * the reverse of accmag_init().
+ */
+static void stop_devices(void)
+{
+	int i, n;
+
+	/* no reader may publish while the streams go */
+	for (i=0;i<nunits*2;i++)
+		sios_del_source_ctx(&units[i/2].sensor[i%2].ctx);
+	for (n=0;n<nunits;n++) {
+		for (i=0;i<UNIT_NSTREAMS;i++) {
+			if (units[n].streams[i].obj) {
+				sios_stream_exit(&units[n].streams[i]);
+				units[n].streams[i].obj = NULL;
+			}
+		}
+	}
+	for (i=0;i<NSTREAMS;i++) {
+		if (STREAM_USED(i)) {
+			sios_stream_exit(&streams[i]);
+			streams[i].obj = NULL;
+		}
+	}
+}
+
+/* close and free the sensors of all devices */
+static void free_devices(void)
+{
+	struct accmag_dev * dev;
+	int i;
+
+	for (i=0;i<nunits*2;i++) {
+		dev = &units[i/2].sensor[i%2];
+		if (dev->ctx.fd >= 0) {
+			sios_del_source_ctx(&dev->ctx);
+			close(dev->ctx.fd);
+		}
+		filter_chain_free(dev->filter);
+		if (dev->spectrum) {
+			spectrum_free(dev->spectrum);
+			free(dev->spectrum);
+		}
+		if (dev->gesture) {
+			gesture_engine_free(dev->gesture);
+			free(dev->gesture);
+		}
+		pthread_mutex_destroy(&dev->c_data.lock);
+	}
+	free(units);
+	units = NULL;
+	nunits = 0;
+}
+
+/*
+ * The acc, mag and orientation streams of one device, e.g. 3/acc/listen
+ * sends /sios/sensors/accmag/3/acc/data. A listener only wakes the
+ * sensors of that device.
+ */
+static void init_unit_streams(struct accmag_unit * unit, int num)
+{
+	char sub[SIOS_MAX_NAMESIZE], path[SIOS_MAX_PATHSIZE];
+	int i;
+
+	for (i=0;i<UNIT_NSTREAMS;i++) {
+		snprintf(sub, sizeof(sub), "%d/%s", num, accmag_sub[i]);
+		snprintf(path, sizeof(path), ACCMAG_UNIT_PATH, num, accmag_sub[i]);
+		if (i == OM)
+			sios_stream_init(&unit->streams[i], THIS_MODULE, sub, path,
+					 sizeof(struct sios_shm_orientation), orientation_encode);
+		else
+			sios_stream_init(&unit->streams[i], THIS_MODULE, sub, path,
+					 sizeof(struct sios_shm_accmag), accmag_encode);
+		unit->streams[i].wake = accmag_wake;
+		unit->streams[i].priv = unit;
+	}
+}
+
+/*
+ * Reply with the estimated sample rates, one message per device:
+ * dev, acc and mag samples per second
+ */
+static int rate_handler(const char *path, const char *types, lo_arg **argv,
+			int argc, lo_message msg, void *user_data)
+{
+	lo_address addr;
+	lo_message reply;
+	int i, retval = 0;
+
+	addr = sios_osc_listener_address(msg, types, argc, argv);
+	if (!addr)
+		return -1;
+
+	for (i=0;i<nunits && !retval;i++) {
+		reply = lo_message_new();
+		lo_message_add_int32(reply, i);
+		lo_message_add_float(reply, dev_rate(&units[i].sensor[AM]));
+		lo_message_add_float(reply, dev_rate(&units[i].sensor[MM]));
+		retval = sios_osc_dispatch_msg(addr, ACCMAG_RATE_PATH, reply) < 0 ? -1 : 0;
+		lo_message_free(reply);
+	}
+
+	lo_address_free(addr);
+	return retval;
+}
+
+/*
+ * Reply with the activation state, one message per device:
+ * dev, acc and mag read (1) or idle (0)
+ */
+static int status_handler(const char *path, const char *types, lo_arg **argv,
+			  int argc, lo_message msg, void *user_data)
+{
+	lo_address addr;
+	lo_message reply;
+	int i, retval = 0;
+
+	addr = sios_osc_listener_address(msg, types, argc, argv);
+	if (!addr)
+		return -1;
+
+	for (i=0;i<nunits && !retval;i++) {
+		reply = lo_message_new();
+		lo_message_add_int32(reply, i);
+		lo_message_add_int32(reply, units[i].sensor[AM].active);
+		lo_message_add_int32(reply, units[i].sensor[MM].active);
+		retval = sios_osc_dispatch_msg(addr, ACCMAG_STATUS_PATH, reply) < 0 ? -1 : 0;
+		lo_message_free(reply);
+	}
+
+	lo_address_free(addr);
+	return retval;
+}
+
 /* FIXME
  * Rewrite accmag driver in a better way ;0
  */
 struct sios_method_desc osc_methods[] = {
-	METHOD_DESC_INITIALIZER("acc_listen", "acc/listen", NULL, add_acc_listen_source_handler, "start data transfer"),
-	METHOD_DESC_INITIALIZER("mag_listen", "mag/listen", NULL, add_mag_listen_source_handler, "start data transfer"),
-	METHOD_DESC_INITIALIZER("acc_silence", "acc/silence", NULL, del_acc_listen_source_handler, "stop data transfer"),
-	METHOD_DESC_INITIALIZER("mag_silence", "mag/silence", NULL, del_mag_listen_source_handler, "stop data transfer"),
 	METHOD_DESC_INITIALIZER("mag_calibrate", "mag/calibrate", NULL, mag_calibrate_handler, "calibrate magnetometer"),
+	METHOD_DESC_INITIALIZER("rate", "rate", NULL, rate_handler, "send the estimated sample rates"),
+	METHOD_DESC_INITIALIZER("status", "status", NULL, status_handler, "send which sensors are read"),
 };
 
 
 int accmag_init(void)
 {
-	int i, retval = 0;
+	int i, n, t, retval = 0;
 
+	init_gestures();
 	retval = init_devices(devices);
 	if (retval > 0) {
 		err(MODULE_NAME, "error opening %d acc/mag devices",  retval);
+		free_devices();
 		return -retval;
 	} else if (retval < 0) {
 		err(MODULE_NAME, "out of memory while opening devices");
+		free_devices();
 		return retval;
 	}
+	load_calibrations();
 	
 	retval = sios_object_register(THIS_MODULE, THIS_CLASS);
 	if (retval) {
 		err(MODULE_NAME, "error registering accmag object");
+		free_devices();
 		return retval;
 	}
 	
-	info(MODULE_NAME, "have sources: %d", ACCMAG_SOURCES(ctxs));
-	for (i=0;i<devices*2;i++) {
-		if (ctxs[i].fd > 0)
-			if (sios_add_source_ctx(&ctxs[i])) 
-				retval++;
+	/* before the sources, their handlers publish */
+	for (i=0;i<2;i++)
+		sios_stream_init(&streams[i], THIS_MODULE, accmag_sub[i], accmag_path[i],
+				 sizeof(struct sios_shm_accmag), accmag_encode);
+	sios_stream_init(&streams[OM], THIS_MODULE, accmag_sub[OM], accmag_path[OM],
+			 sizeof(struct sios_shm_orientation), orientation_encode);
+	if (filter_raw) {
+		for (i=RAW;i<RAW+2;i++)
+			sios_stream_init(&streams[i], THIS_MODULE, accmag_sub[i], accmag_path[i],
+					 sizeof(struct sios_shm_accmag), accmag_encode);
 	}
+	if (units[0].sensor[AM].spectrum)
+		sios_stream_init(&streams[SP], THIS_MODULE, accmag_sub[SP], accmag_path[SP],
+				 sizeof(struct sios_shm_spectrum), spectrum_encode);
+	if (units[0].sensor[AM].gesture)
+		sios_stream_init(&streams[GE], THIS_MODULE, accmag_sub[GE], accmag_path[GE],
+				 sizeof(struct sios_shm_gesture), gesture_encode);
+	for (i=0;i<NSTREAMS;i++)
+		streams[i].wake = accmag_wake;
+	for (n=0;n<nunits;n++)
+		init_unit_streams(&units[n], n);
+
+	info(MODULE_NAME, "have sources: %d", nunits * 2);
+	for (n=0;n<nunits;n++) {
+		for (t=AM;t<=MM;t++) {
+			struct accmag_dev * dev = &units[n].sensor[t];
+
+			if (dev->ctx.fd >= 0 && dev_wanted(dev)) {
+				if (sios_add_source_ctx(&dev->ctx))
+					retval++;
+				else
+					dev->active = 1;
+			}
+		}
+	}
+	if (demand)
+		info(MODULE_NAME, "reading sensors on demand");
 
 	if (retval) {
 		err(MODULE_NAME, "error adding %d acc/mag sources", retval);
+		stop_devices();
+		free_devices();
 		sios_object_deregister(THIS_MODULE);
 		return -1;
 	}
+	for (i=0;i<NSTREAMS;i++)
+		if (STREAM_USED(i))
+			sios_stream_add_methods(&streams[i]);
+	for (n=0;n<nunits;n++)
+		for (i=0;i<UNIT_NSTREAMS;i++)
+			sios_stream_add_methods(&units[n].streams[i]);
+	/* methods can not be removed again, a failure here leaves the
+	 * streams up for the ones already added */
 	retval = sios_osc_add_method_descs(osc_methods, METHOD_DESCRIPTORS(osc_methods));
 
 	return retval;
@@ -580,11 +932,8 @@ int accmag_init(void)
 
 void accmag_exit(void)
 {
-	int i;
-	for (i=0;i<ACCMAG_SOURCES(ctxs);i++) {
-		close(ctxs[i].fd);
-		sios_del_source_ctx(&ctxs[i]);
-	}
+	stop_devices();
+	free_devices();
 	sios_object_deregister(THIS_MODULE);
 }
 
@@ -0,0 +1,279 @@
+/**
+ *  @file calibrate.c
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include "calibrate.h"
+
+/* samples are fitted in units of FIT_SCALE counts, keeps the sums near 1 */
+#define FIT_SCALE	1024.0
+
+#define JACOBI_SWEEPS	16
+
+void mag_calibration_identity(struct mag_calibration * cal)
+{
+	memset(cal, 0, sizeof(*cal));
+	cal->soft[0][0] = cal->soft[1][1] = cal->soft[2][2] = MM_FIXED_ONE;
+}
+
+void mag_fit_reset(struct mag_fit * fit)
+{
+	memset(fit, 0, sizeof(*fit));
+}
+
+void mag_fit_add(struct mag_fit * fit, int x, int y, int z)
+{
+	double u = x / FIT_SCALE, v = y / FIT_SCALE, w = z / FIT_SCALE;
+	double d[MAG_FIT_TERMS] = {
+		u * u, v * v, w * w, 2 * u * v, 2 * u * w, 2 * v * w, 2 * u, 2 * v, 2 * w
+	};
+	int i, j;
+
+	for (i=0;i<MAG_FIT_TERMS;i++) {
+		for (j=i;j<MAG_FIT_TERMS;j++)
+			fit->ata[i][j] += d[i] * d[j];
+		fit->atb[i] += d[i];
+	}
+	fit->samples++;
+}
+
+/*
+ * Gaussian elimination with partial pivoting, solves m x = b in place,
+ * x ends up in b.
+ */
+static int solve(double m[MAG_FIT_TERMS][MAG_FIT_TERMS], double b[MAG_FIT_TERMS])
+{
+	double t, f;
+	int i, j, k, p;
+
+	for (i=0;i<MAG_FIT_TERMS;i++) {
+		p = i;
+		for (k=i+1;k<MAG_FIT_TERMS;k++)
+			if (fabs(m[k][i]) > fabs(m[p][i]))
+				p = k;
+		if (fabs(m[p][i]) < 1e-12)
+			return -1;
+		if (p != i) {
+			for (j=0;j<MAG_FIT_TERMS;j++) {
+				t = m[i][j]; m[i][j] = m[p][j]; m[p][j] = t;
+			}
+			t = b[i]; b[i] = b[p]; b[p] = t;
+		}
+		for (k=i+1;k<MAG_FIT_TERMS;k++) {
+			f = m[k][i] / m[i][i];
+			for (j=i;j<MAG_FIT_TERMS;j++)
+				m[k][j] -= f * m[i][j];
+			b[k] -= f * b[i];
+		}
+	}
+
+	for (i=MAG_FIT_TERMS-1;i>=0;i--) {
+		for (j=i+1;j<MAG_FIT_TERMS;j++)
+			b[i] -= m[i][j] * b[j];
+		b[i] /= m[i][i];
+	}
+
+	return 0;
+}
+
+/*
+ * Eigen decomposition of a symmetric 3x3 matrix, a = v diag(l) v'.
+ * a is destroyed.
+ */
+static void jacobi3(double a[3][3], double l[3], double v[3][3])
+{
+	double theta, t, c, s, apq, app, aqq, ar, vr;
+	int sweep, p, q, r;
+
+	memset(v, 0, sizeof(double) * 9);
+	v[0][0] = v[1][1] = v[2][2] = 1.0;
+
+	for (sweep=0;sweep<JACOBI_SWEEPS;sweep++) {
+		if (fabs(a[0][1]) + fabs(a[0][2]) + fabs(a[1][2]) < 1e-15)
+			break;
+		for (p=0;p<2;p++) {
+			for (q=p+1;q<3;q++) {
+				apq = a[p][q];
+				if (fabs(apq) < 1e-300)
+					continue;
+				app = a[p][p];
+				aqq = a[q][q];
+				theta = (aqq - app) / (2 * apq);
+				t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1));
+				c = 1 / sqrt(t * t + 1);
+				s = t * c;
+
+				a[p][p] = app - t * apq;
+				a[q][q] = aqq + t * apq;
+				a[p][q] = a[q][p] = 0;
+				for (r=0;r<3;r++) {
+					if (r != p && r != q) {
+						ar = a[r][p];
+						a[r][p] = a[p][r] = c * ar - s * a[r][q];
+						a[r][q] = a[q][r] = s * ar + c * a[r][q];
+					}
+					vr = v[r][p];
+					v[r][p] = c * vr - s * v[r][q];
+					v[r][q] = s * vr + c * v[r][q];
+				}
+			}
+		}
+	}
+
+	for (p=0;p<3;p++)
+		l[p] = a[p][p];
+}
+
+static inline mm_fixed_t dtofix(double x)
+{
+	return (mm_fixed_t)floor(x * MM_FIXED_ONE + 0.5);
+}
+
+int mag_fit_solve(struct mag_fit * fit, struct mag_calibration * cal)
+{
+	double m[MAG_FIT_TERMS][MAG_FIT_TERMS], p[MAG_FIT_TERMS];
+	double a[3][3], ai[3][3], c[3], l[3], v[3][3], det, k, r;
+	int i, j, n;
+
+	if (fit->samples < MAG_FIT_MIN_SAMPLES)
+		return -1;
+
+	for (i=0;i<MAG_FIT_TERMS;i++) {
+		for (j=i;j<MAG_FIT_TERMS;j++)
+			m[i][j] = m[j][i] = fit->ata[i][j];
+		p[i] = fit->atb[i];
+	}
+	if (solve(m, p))
+		return -1;
+
+	/* x' a x + 2 b' x = 1 */
+	a[0][0] = p[0]; a[1][1] = p[1]; a[2][2] = p[2];
+	a[0][1] = a[1][0] = p[3];
+	a[0][2] = a[2][0] = p[4];
+	a[1][2] = a[2][1] = p[5];
+
+	ai[0][0] = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+	ai[0][1] = a[0][2] * a[2][1] - a[0][1] * a[2][2];
+	ai[0][2] = a[0][1] * a[1][2] - a[0][2] * a[1][1];
+	ai[1][1] = a[0][0] * a[2][2] - a[0][2] * a[2][0];
+	ai[1][2] = a[0][2] * a[1][0] - a[0][0] * a[1][2];
+	ai[2][2] = a[0][0] * a[1][1] - a[0][1] * a[1][0];
+	ai[1][0] = ai[0][1]; ai[2][0] = ai[0][2]; ai[2][1] = ai[1][2];
+	det = a[0][0] * ai[0][0] + a[0][1] * ai[1][0] + a[0][2] * ai[2][0];
+	if (fabs(det) < 1e-300)
+		return -1;
+
+	/* center c = -a^-1 b, then (x - c)' a (x - c) = 1 + c' a c */
+	for (i=0;i<3;i++)
+		c[i] = -(ai[i][0] * p[6] + ai[i][1] * p[7] + ai[i][2] * p[8]) / det;
+	k = 1;
+	for (i=0;i<3;i++)
+		for (j=0;j<3;j++)
+			k += c[i] * a[i][j] * c[j];
+	if (fabs(k) < 1e-300)
+		return -1;
+	for (i=0;i<3;i++)
+		for (j=0;j<3;j++)
+			a[i][j] /= k;
+
+	/* an ellipsoid only if all axes are real */
+	jacobi3(a, l, v);
+	if (l[0] <= 0 || l[1] <= 0 || l[2] <= 0)
+		return -1;
+
+	/* soft = r sqrt(a), r the geometric mean radius keeps the scale */
+	r = 1 / sqrt(cbrt(l[0] * l[1] * l[2]));
+	for (i=0;i<3;i++) {
+		for (j=0;j<3;j++) {
+			double s = 0;
+			for (n=0;n<3;n++)
+				s += v[i][n] * sqrt(l[n]) * v[j][n];
+			if (fabs(r * s) >= 32768.0)
+				return -1;
+			cal->soft[i][j] = dtofix(r * s);
+		}
+		if (fabs(c[i] * FIT_SCALE) >= 1 << 20)
+			return -1;
+		cal->offset[i] = (int32_t)floor(c[i] * FIT_SCALE + 0.5);
+	}
+
+	return 0;
+}
+
+int mag_calibration_save(const char * file, const struct mag_calibration * cal)
+{
+	char tmp[256];
+	FILE * f;
+	int i, n;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", file) >= (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	f = fopen(tmp, "w");
+	if (!f)
+		return -1;
+
+	n = fprintf(f, "offset %d %d %d\nsoft", cal->offset[0], cal->offset[1], cal->offset[2]);
+	for (i=0;i<9 && n > 0;i++)
+		n = fprintf(f, " %d", cal->soft[i / 3][i % 3]);
+	if (n > 0)
+		n = fprintf(f, "\n");
+
+	/* a short write must not replace a good file */
+	if (fclose(f) || n < 0 || rename(tmp, file)) {
+		n = errno;
+		remove(tmp);
+		errno = n;
+		return -1;
+	}
+
+	return 0;
+}
+
+int mag_calibration_load(const char * file, struct mag_calibration * cal)
+{
+	struct mag_calibration c;
+	FILE * f;
+	int n;
+
+	f = fopen(file, "r");
+	if (!f)
+		return -1;
+
+	n = fscanf(f, " offset %d %d %d soft %d %d %d %d %d %d %d %d %d",
+		   &c.offset[0], &c.offset[1], &c.offset[2],
+		   &c.soft[0][0], &c.soft[0][1], &c.soft[0][2],
+		   &c.soft[1][0], &c.soft[1][1], &c.soft[1][2],
+		   &c.soft[2][0], &c.soft[2][1], &c.soft[2][2]);
+	fclose(f);
+
+	if (n != 12) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*cal = c;
+	return 0;
+}
@@ -0,0 +1,114 @@
+/**
+ *  @file calibrate.h
+ *
+ *  Hard and soft iron magnetometer calibration.
+ *
+ *  While the device is turned around, every raw sample is added to the
+ *  sums of a least squares fit of the general ellipsoid
+ *
+ *  	a x^2 + b y^2 + c z^2 + 2d xy + 2e xz + 2f yz + 2g x + 2h y + 2i z = 1
+ *
+ *  which take constant space whatever the number of samples. Solving it
+ *  gives the hard iron offset, the ellipsoid's center, and the soft iron
+ *  matrix that maps the ellipsoid onto a sphere of the same mean radius.
+ *  Only the solve uses floating point, once per calibration. The
+ *  correction of every sample is fixed point.
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ACCMAG_CALIBRATE_H
+#define ACCMAG_CALIBRATE_H
+
+#include <stdint.h>
+
+#include <platform/fixed.h>
+
+#define MAG_FIT_TERMS		9
+
+/* fewer samples can not pin down nine parameters reliably */
+#define MAG_FIT_MIN_SAMPLES	64
+
+/**
+ * Correction applied to every magnetometer sample:
+ * corrected = soft * (raw - offset)
+ */
+struct mag_calibration {
+	int32_t offset[3];		/**< Hard iron offset, raw units */
+	mm_fixed_t soft[3][3];		/**< Soft iron matrix, 16.16 */
+};
+
+/**
+ * Streaming sums of the ellipsoid fit.
+ */
+struct mag_fit {
+	double ata[MAG_FIT_TERMS][MAG_FIT_TERMS];	/**< D'D, upper triangle */
+	double atb[MAG_FIT_TERMS];			/**< D'1 */
+	int samples;					/**< Samples added */
+};
+
+void mag_calibration_identity(struct mag_calibration * cal);
+
+void mag_fit_reset(struct mag_fit * fit);
+
+void mag_fit_add(struct mag_fit * fit, int x, int y, int z);
+
+/**
+ * Solve the fit.
+ *
+ * @return 0 and the calibration on success, -1 if the samples do not
+ * describe an ellipsoid, e.g. because the device was hardly turned
+ */
+int mag_fit_solve(struct mag_fit * fit, struct mag_calibration * cal);
+
+/**
+ * Store a calibration in a text file, replaced atomically:
+ *
+ * 	offset <x> <y> <z>
+ * 	soft <m00> <m01> <m02> <m10> <m11> <m12> <m20> <m21> <m22>
+ *
+ * with the matrix in 16.16.
+ *
+ * @return 0 on success, -1 with errno set on failure
+ */
+int mag_calibration_save(const char * file, const struct mag_calibration * cal);
+
+/**
+ * Load a calibration written by mag_calibration_save().
+ *
+ * @return 0 on success, -1 if the file is missing, errno ENOENT, or
+ * invalid, cal is left untouched then
+ */
+int mag_calibration_load(const char * file, struct mag_calibration * cal);
+
+static inline int16_t mag_clamp16(int64_t v)
+{
+	return v > 32767 ? 32767 : v < -32768 ? -32768 : (int16_t)v;
+}
+
+static inline void mag_calibration_apply(const struct mag_calibration * cal,
+					 int16_t * x, int16_t * y, int16_t * z)
+{
+	int64_t dx = *x - cal->offset[0], dy = *y - cal->offset[1], dz = *z - cal->offset[2];
+	int64_t half = 1 << (MM_FIXED_RADIX - 1);
+
+	*x = mag_clamp16((cal->soft[0][0] * dx + cal->soft[0][1] * dy + cal->soft[0][2] * dz + half) >> MM_FIXED_RADIX);
+	*y = mag_clamp16((cal->soft[1][0] * dx + cal->soft[1][1] * dy + cal->soft[1][2] * dz + half) >> MM_FIXED_RADIX);
+	*z = mag_clamp16((cal->soft[2][0] * dx + cal->soft[2][1] * dy + cal->soft[2][2] * dz + half) >> MM_FIXED_RADIX);
+}
+
+#endif /* ACCMAG_CALIBRATE_H */
@@ -0,0 +1,229 @@
+/**
+ *  @file fft.c
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fft.h"
+
+#define Q15_ONE		32768
+
+static inline int32_t q15(double v)
+{
+	return (int32_t)floor(v * Q15_ONE + 0.5);
+}
+
+int fft_init(struct fft * f, int size)
+{
+	int k;
+
+	memset(f, 0, sizeof(*f));
+	if (size < FFT_MIN_SIZE || size > FFT_MAX_SIZE || (size & (size - 1)))
+		return -1;
+
+	f->size = size;
+	for (f->bits = 0; (1 << f->bits) < size; f->bits++)
+		;
+
+	f->cos = (int32_t*)malloc(sizeof(int32_t) * size / 2);
+	f->sin = (int32_t*)malloc(sizeof(int32_t) * size / 2);
+	f->window = (int32_t*)malloc(sizeof(int32_t) * size);
+	if (!f->cos || !f->sin || !f->window) {
+		fft_free(f);
+		return -1;
+	}
+
+	/* the only floating point, once */
+	for (k=0;k<size/2;k++) {
+		f->cos[k] = q15(cos(2 * M_PI * k / size));
+		f->sin[k] = q15(sin(2 * M_PI * k / size));
+	}
+	for (k=0;k<size;k++)
+		f->window[k] = q15(0.5 - 0.5 * cos(2 * M_PI * k / size));
+
+	return 0;
+}
+
+void fft_free(struct fft * f)
+{
+	free(f->cos);
+	free(f->sin);
+	free(f->window);
+	f->cos = f->sin = f->window = NULL;
+}
+
+void fft_run(const struct fft * f, int32_t * re, int32_t * im)
+{
+	int i, j, k, len, half, step;
+	int32_t t, tr, ti, c, s;
+
+	/* bit reversed order */
+	for (i=1, j=0;i<f->size;i++) {
+		for (k=f->size>>1;j & k;k>>=1)
+			j ^= k;
+		j |= k;
+		if (i < j) {
+			t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	/* decimation in time, w = cos - i sin, halved per stage */
+	for (len=2, step=f->size>>1;len<=f->size;len<<=1, step>>=1) {
+		half = len >> 1;
+		for (i=0;i<f->size;i+=len) {
+			for (j=0;j<half;j++) {
+				int a = i + j, b = a + half;
+
+				c = f->cos[j * step];
+				s = f->sin[j * step];
+				tr = (int32_t)(((int64_t)re[b] * c + (int64_t)im[b] * s + (Q15_ONE >> 1)) >> 15);
+				ti = (int32_t)(((int64_t)im[b] * c - (int64_t)re[b] * s + (Q15_ONE >> 1)) >> 15);
+				re[b] = (re[a] - tr + 1) >> 1;
+				im[b] = (im[a] - ti + 1) >> 1;
+				re[a] = (re[a] + tr + 1) >> 1;
+				im[a] = (im[a] + ti + 1) >> 1;
+			}
+		}
+	}
+}
+
+int spectrum_init(struct spectrum * s, int size)
+{
+	memset(s, 0, sizeof(*s));
+	if (fft_init(&s->fft, size))
+		return -1;
+
+	s->hist = (int16_t*)malloc(sizeof(int16_t) * 3 * size);
+	s->re = (int32_t*)malloc(sizeof(int32_t) * size);
+	s->im = (int32_t*)malloc(sizeof(int32_t) * size);
+	s->power = (uint64_t*)malloc(sizeof(uint64_t) * (size / 2 + 1));
+	if (!s->hist || !s->re || !s->im || !s->power) {
+		spectrum_free(s);
+		return -1;
+	}
+
+	return 0;
+}
+
+void spectrum_free(struct spectrum * s)
+{
+	fft_free(&s->fft);
+	free(s->hist);
+	free(s->re);
+	free(s->im);
+	free(s->power);
+	s->hist = NULL;
+	s->re = s->im = NULL;
+	s->power = NULL;
+}
+
+void spectrum_reset(struct spectrum * s)
+{
+	s->fill = 0;
+}
+
+static uint32_t isqrt64(uint64_t v)
+{
+	uint64_t r = 0, bit = 1ULL << 62;
+
+	while (bit > v)
+		bit >>= 2;
+	while (bit) {
+		if (v >= r + bit) {
+			v -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint32_t)r;
+}
+
+/* power of the three axes of the window, summed per bin */
+static void spectrum_power(struct spectrum * s)
+{
+	int n = s->fft.size, axis, k;
+	const int16_t * h;
+	int64_t mean;
+
+	memset(s->power, 0, sizeof(uint64_t) * (n / 2 + 1));
+	for (axis=0;axis<3;axis++) {
+		h = s->hist + axis * n;
+		mean = 0;
+		for (k=0;k<n;k++)
+			mean += h[k];
+		mean = mean >= 0 ? (mean + n / 2) / n : -((-mean + n / 2) / n);
+
+		for (k=0;k<n;k++) {
+			s->re[k] = (int32_t)((((int64_t)(h[k] - mean) << FFT_SHIFT) * s->fft.window[k]) >> 15);
+			s->im[k] = 0;
+		}
+		fft_run(&s->fft, s->re, s->im);
+
+		for (k=0;k<=n/2;k++)
+			s->power[k] += (uint64_t)((int64_t)s->re[k] * s->re[k] + (int64_t)s->im[k] * s->im[k]);
+	}
+}
+
+int spectrum_run(struct spectrum * s, int16_t x, int16_t y, int16_t z, float rate,
+		 struct sios_shm_spectrum * record)
+{
+	int n = s->fft.size, k, b, peak = 1;
+	uint64_t ms[SIOS_SPECTRUM_BANDS], p;
+	double a, m, c, d;
+
+	s->hist[s->fill] = x;
+	s->hist[n + s->fill] = y;
+	s->hist[2 * n + s->fill] = z;
+	if (++s->fill < n)
+		return 0;
+	s->fill = 0;
+
+	spectrum_power(s);
+
+	/* one sided, the bins below n / 2 stand for their mirror image too,
+	 * and 8 / 3 undoes the power the Hann window takes */
+	memset(ms, 0, sizeof(ms));
+	for (k=1;k<=n/2;k++) {
+		p = k < n / 2 ? s->power[k] * 2 : s->power[k];
+		b = k * SIOS_SPECTRUM_BANDS / (n / 2);
+		ms[b < SIOS_SPECTRUM_BANDS ? b : SIOS_SPECTRUM_BANDS - 1] += p;
+		if (s->power[k] > s->power[peak])
+			peak = k;
+	}
+	for (b=0;b<SIOS_SPECTRUM_BANDS;b++)
+		record->band[b] = isqrt64(ms[b] / 3 * 8);
+
+	/* the peak between bins, from a parabola through the magnitudes */
+	d = 0;
+	if (peak < n / 2) {
+		a = sqrt((double)s->power[peak - 1]);
+		m = sqrt((double)s->power[peak]);
+		c = sqrt((double)s->power[peak + 1]);
+		if (a - 2 * m + c < 0)
+			d = 0.5 * (a - c) / (a - 2 * m + c);
+	}
+	record->peak = rate > 0 && s->power[peak] ? (uint32_t)((peak + d) * rate * 1000 / n + 0.5) : 0;
+
+	return 1;
+}
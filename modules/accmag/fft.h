@@ -0,0 +1,98 @@
+/**
+ *  @file fft.h
+ *
+ *  Fixed point radix-2 FFT and vibration spectra of accmag samples.
+ *
+ *  The FFT works in place on 32 bit integers, twiddles and window are
+ *  Q15. Every stage halves its outputs, so the result is the transform
+ *  divided by the size and can not overflow whatever the input.
+ *
+ *  A spectrum collects windows of N acc samples. For each full window it
+ *  removes the mean of every axis, applies a Hann window, transforms the
+ *  three axes and sums their power. It reports the dominant frequency
+ *  and the RMS acceleration in SIOS_SPECTRUM_BANDS equal bands between
+ *  0 and half the sample rate.
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ACCMAG_FFT_H
+#define ACCMAG_FFT_H
+
+#include <stdint.h>
+
+#include <platform/sios_shm.h>
+
+#define FFT_MIN_SIZE		16
+#define FFT_MAX_SIZE		4096
+
+/* fraction bits samples get before they are transformed */
+#define FFT_SHIFT		8
+
+struct fft {
+	int size;			/**< Number of points, a power of two */
+	int bits;			/**< log2(size) */
+	int32_t * cos;			/**< cos(2 pi k / size), Q15, size / 2 entries */
+	int32_t * sin;			/**< sin(2 pi k / size), Q15 */
+	int32_t * window;		/**< Hann window, Q15, size entries */
+};
+
+/**
+ * Set up the tables for a size.
+ *
+ * @return 0 on success, -1 if size is no power of two in range or out of memory
+ */
+int fft_init(struct fft * f, int size);
+
+void fft_free(struct fft * f);
+
+/**
+ * Transform re + i im in place, the result is divided by the size.
+ */
+void fft_run(const struct fft * f, int32_t * re, int32_t * im);
+
+struct spectrum {
+	struct fft fft;
+	int fill;			/**< Samples in the window */
+	int16_t * hist;			/**< The window, x, y and z after each other */
+	int32_t * re, * im;		/**< Transform buffers */
+	uint64_t * power;		/**< Summed power per bin, counts^2 << 2 FFT_SHIFT */
+};
+
+/**
+ * @return 0 on success, -1 if size is invalid or out of memory
+ */
+int spectrum_init(struct spectrum * s, int size);
+
+void spectrum_free(struct spectrum * s);
+
+/**
+ * Start a new window.
+ */
+void spectrum_reset(struct spectrum * s);
+
+/**
+ * Add a sample.
+ *
+ * @param rate Sample rate in Hz, for the dominant frequency, 0 if unknown
+ * @return 1 with record filled in, except dev, when the window is complete,
+ * 0 otherwise
+ */
+int spectrum_run(struct spectrum * s, int16_t x, int16_t y, int16_t z, float rate,
+		 struct sios_shm_spectrum * record);
+
+#endif /* ACCMAG_FFT_H */
@@ -0,0 +1,247 @@
+/**
+ *  @file fft_bench.c
+ *
+ *  Accuracy and speed of the fixed point FFT of fft.c.
+ *
+ *  Accuracy is measured against a double precision FFT of the same
+ *  input, as the signal to error ratio of the whole transform and the
+ *  largest error of a bin in input counts, for full scale noise, quiet
+ *  noise and a sine. The spectrum is checked on a sine of known
+ *  frequency and amplitude. Speed is the time of one transform and of
+ *  one spectrum window of three axes.
+ *
+ *  	fftbench -n 10000
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "fft.h"
+
+#define DEFAULT_ITERATIONS	10000
+
+/* keeps the compiler from dropping the transforms */
+static volatile long sink;
+
+static double now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* the reference, same algorithm in double precision, divided by n */
+static void fft_double(int n, double * re, double * im)
+{
+	int i, j, k, len;
+	double t, wr, wi, tr, ti;
+
+	for (i=1, j=0;i<n;i++) {
+		for (k=n>>1;j & k;k>>=1)
+			j ^= k;
+		j |= k;
+		if (i < j) {
+			t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	for (len=2;len<=n;len<<=1) {
+		for (i=0;i<n;i+=len) {
+			for (j=0;j<len/2;j++) {
+				wr = cos(2 * M_PI * j / len);
+				wi = sin(2 * M_PI * j / len);
+				tr = re[i+j+len/2] * wr + im[i+j+len/2] * wi;
+				ti = im[i+j+len/2] * wr - re[i+j+len/2] * wi;
+				re[i+j+len/2] = re[i+j] - tr;
+				im[i+j+len/2] = im[i+j] - ti;
+				re[i+j] += tr;
+				im[i+j] += ti;
+			}
+		}
+	}
+
+	for (i=0;i<n;i++) {
+		re[i] /= n;
+		im[i] /= n;
+	}
+}
+
+static void input(int n, int kind, int16_t * x)
+{
+	int i;
+
+	for (i=0;i<n;i++) {
+		switch (kind) {
+			case 0:		/* full scale noise */
+				x[i] = (int16_t)(rand() % 65536 - 32768);
+				break;
+			case 1:		/* quiet noise */
+				x[i] = (int16_t)(rand() % 65 - 32);
+				break;
+			default:	/* a sine between bins */
+				x[i] = (int16_t)floor(20000 * sin(2 * M_PI * 10.3 * i / n) + 0.5);
+				break;
+		}
+	}
+}
+
+static void accuracy(int n)
+{
+	static const char * kinds[] = { "noise", "quiet noise", "sine" };
+	struct fft f;
+	int32_t * re = (int32_t*)malloc(sizeof(int32_t) * n), * im = (int32_t*)malloc(sizeof(int32_t) * n);
+	double * dre = (double*)malloc(sizeof(double) * n), * dim = (double*)malloc(sizeof(double) * n);
+	int16_t * x = (int16_t*)malloc(sizeof(int16_t) * n);
+	double sig, noise, err, worst, scale = 1 << FFT_SHIFT;
+	int kind, i;
+
+	fft_init(&f, n);
+	for (kind=0;kind<3;kind++) {
+		input(n, kind, x);
+		for (i=0;i<n;i++) {
+			re[i] = x[i] * (1 << FFT_SHIFT);
+			im[i] = 0;
+			dre[i] = x[i];
+			dim[i] = 0;
+		}
+		fft_run(&f, re, im);
+		fft_double(n, dre, dim);
+
+		sig = noise = worst = 0;
+		for (i=0;i<n;i++) {
+			double er = re[i] / scale - dre[i], ei = im[i] / scale - dim[i];
+
+			sig += dre[i] * dre[i] + dim[i] * dim[i];
+			err = er * er + ei * ei;
+			noise += err;
+			if (err > worst)
+				worst = err;
+		}
+		printf("%6d %-12s %10.1f %12.4f\n", n, kinds[kind],
+		       10 * log10(sig / (noise > 0 ? noise : 1e-30)), sqrt(worst));
+	}
+	fft_free(&f);
+	free(re); free(im); free(dre); free(dim); free(x);
+}
+
+static void spectrum_check(int n)
+{
+	struct sios_shm_spectrum record;
+	struct spectrum s;
+	double rate = 400.0, freq = 37.3, amp = 1000.0;
+	int i, band;
+
+	spectrum_init(&s, n);
+	for (i=0;i<n;i++) {
+		int16_t v = (int16_t)floor(amp * sin(2 * M_PI * freq * i / rate) + 0.5);
+		spectrum_run(&s, v, 0, 100, (float)rate, &record);
+	}
+	band = (int)(freq / (rate / 2) * SIOS_SPECTRUM_BANDS);
+	printf("%6d %10.3f %10.3f %10.2f %10.2f\n", n, freq, record.peak / 1000.0,
+	       amp / sqrt(2), record.band[band] / 256.0);
+	spectrum_free(&s);
+}
+
+static void speed(int n, int iterations)
+{
+	struct sios_shm_spectrum record;
+	struct spectrum s;
+	struct fft f;
+	int32_t * re = (int32_t*)malloc(sizeof(int32_t) * n), * im = (int32_t*)malloc(sizeof(int32_t) * n);
+	int16_t * x = (int16_t*)malloc(sizeof(int16_t) * n);
+	double start, transform, window;
+	int i, j;
+
+	input(n, 0, x);
+	fft_init(&f, n);
+	start = now_nsec();
+	for (i=0;i<iterations;i++) {
+		for (j=0;j<n;j++) {
+			re[j] = x[j] * (1 << FFT_SHIFT);
+			im[j] = 0;
+		}
+		fft_run(&f, re, im);
+		sink += re[1];
+	}
+	transform = (now_nsec() - start) / iterations;
+	fft_free(&f);
+
+	spectrum_init(&s, n);
+	start = now_nsec();
+	for (i=0;i<iterations;i++)
+		for (j=0;j<n;j++)
+			if (spectrum_run(&s, x[j], x[n-1-j], x[(j * 7) % n], 400.0f, &record))
+				sink += record.peak;
+	window = (now_nsec() - start) / iterations;
+	spectrum_free(&s);
+
+	printf("%6d %12.1f %12.1f %12.1f\n", n, transform / 1e3, window / 1e3, window / n);
+	free(re); free(im); free(x);
+}
+
+static void usage(const char * name)
+{
+	printf("usage: %s [-n iterations]\n", name);
+}
+
+int main(int argc, char * argv[])
+{
+	int iterations = DEFAULT_ITERATIONS;
+	int n, c;
+
+	while ((c = getopt(argc, argv, "n:h")) >= 0) {
+		switch (c) {
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (iterations <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	srand(1);
+	printf("accuracy against double precision\n");
+	printf("%6s %-12s %10s %12s\n", "size", "input", "SNR dB", "max error");
+	for (n=64;n<=FFT_MAX_SIZE;n<<=2)
+		accuracy(n);
+
+	printf("\nspectrum of a sine at 400 Hz\n");
+	printf("%6s %10s %10s %10s %10s\n", "size", "Hz", "peak Hz", "RMS", "band RMS");
+	for (n=64;n<=FFT_MAX_SIZE;n<<=2)
+		spectrum_check(n);
+
+	printf("\n%d iterations\n", iterations);
+	printf("%6s %12s %12s %12s\n", "size", "fft us", "window us", "ns/sample");
+	for (n=64;n<=FFT_MAX_SIZE;n<<=2)
+		speed(n, iterations);
+
+	return 0;
+}
@@ -0,0 +1,319 @@
+/**
+ *  @file filter.c
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/sios.h>
+
+#include "filter.h"
+
+static const struct {
+	const char * name;
+	enum filter_type type;
+	int args;
+} filter_types[] = {
+	{ "lowpass", FILTER_LOWPASS, 1 },
+	{ "average", FILTER_AVERAGE, 1 },
+	{ "median", FILTER_MEDIAN, 1 },
+	{ "biquad", FILTER_BIQUAD, 5 },
+};
+
+static int filter_parse_stage(struct filter * f, char * desc)
+{
+	double args[5];
+	char * name, * tok, * save, * end;
+	unsigned int i;
+	int n = 0;
+
+	name = strtok_r(desc, " \t", &save);
+	if (!name)
+		return -1;
+
+	while ((tok = strtok_r(NULL, " \t", &save)) && n < 5) {
+		args[n++] = strtod(tok, &end);
+		/* "5x" is no number */
+		if (end == tok || *end)
+			return -1;
+	}
+
+	memset(f, 0, sizeof(*f));
+	for (i=0;i<sizeof(filter_types)/sizeof(filter_types[0]);i++) {
+		if (strcmp(name, filter_types[i].name))
+			continue;
+		if (n != filter_types[i].args || tok)
+			break;
+
+		f->type = filter_types[i].type;
+		switch (f->type) {
+			case FILTER_LOWPASS:
+				if (args[0] <= 0.0 || args[0] > 1.0)
+					return -1;
+				f->c[0] = ftofix(args[0]);
+				break;
+			case FILTER_AVERAGE:
+			case FILTER_MEDIAN:
+				f->taps = (int)args[0];
+				if (f->taps < 1 || f->taps > FILTER_MAX_TAPS)
+					return -1;
+				break;
+			case FILTER_BIQUAD:
+				for (n=0;n<5;n++) {
+					if (args[n] <= -32768.0 || args[n] >= 32768.0)
+						return -1;
+					f->c[n] = ftofix(args[n]);
+				}
+				break;
+		}
+		return 0;
+	}
+
+	return -1;
+}
+
+struct filter_chain * filter_chain_parse(const char * spec)
+{
+	struct filter_chain * chain;
+	char * copy, * desc, * save, stage[128];
+	int n = 1;
+	const char * p;
+
+	if (!spec || !spec[0])
+		return NULL;
+
+	for (p = spec; *p; p++)
+		if (*p == ',')
+			n++;
+
+	chain = (struct filter_chain*)malloc(sizeof(struct filter_chain));
+	if (!chain)
+		return NULL;
+	chain->stages = 0;
+	chain->stage = NULL;
+
+	copy = strdup(spec);
+	if (!copy)
+		goto err;
+
+	chain->stage = (struct filter*)malloc(sizeof(struct filter) * n);
+	if (!chain->stage)
+		goto err;
+
+	for (desc = strtok_r(copy, ",", &save); desc; desc = strtok_r(NULL, ",", &save)) {
+		/* parsing cuts up its argument, keep desc for the message */
+		snprintf(stage, sizeof(stage), "%s", desc);
+		if (filter_parse_stage(&chain->stage[chain->stages], stage)) {
+			err("accmag", "invalid filter stage '%s' in '%s'", desc, spec);
+			goto err;
+		}
+		chain->stages++;
+	}
+
+	free(copy);
+	return chain;
+
+err:
+	free(copy);
+	filter_chain_free(chain);
+	return NULL;
+}
+
+void filter_chain_free(struct filter_chain * chain)
+{
+	if (!chain)
+		return;
+	free(chain->stage);
+	free(chain);
+}
+
+void filter_chain_reset(struct filter_chain * chain)
+{
+	int i;
+
+	for (i=0;i<chain->stages;i++)
+		memset(chain->stage[i].axis, 0, sizeof(chain->stage[i].axis));
+}
+
+static int32_t filter_median(struct filter_axis * a)
+{
+	int32_t sorted[FILTER_MAX_TAPS], v;
+	int i, j;
+
+	for (i=0;i<a->fill;i++) {
+		v = a->hist[i];
+		for (j=i;j>0 && sorted[j-1] > v;j--)
+			sorted[j] = sorted[j-1];
+		sorted[j] = v;
+	}
+	return sorted[a->fill / 2];
+}
+
+static int32_t filter_step(struct filter * f, struct filter_axis * a, int32_t x)
+{
+	int64_t acc;
+	int32_t y;
+
+	switch (f->type) {
+		case FILTER_LOWPASS:
+			if (!a->fill++)
+				a->y1 = x;
+			a->y1 += (int32_t)(((int64_t)f->c[0] * (x - a->y1)) >> MM_FIXED_RADIX);
+			return a->y1;
+
+		case FILTER_AVERAGE:
+		case FILTER_MEDIAN:
+			if (a->fill == f->taps)
+				a->sum -= a->hist[a->pos];
+			else
+				a->fill++;
+			a->hist[a->pos] = x;
+			a->sum += x;
+			a->pos = (a->pos + 1) % f->taps;
+			if (f->type == FILTER_AVERAGE)
+				return (int32_t)(a->sum / a->fill);
+			return filter_median(a);
+
+		case FILTER_BIQUAD:
+			/* start in steady state instead of ringing from zero */
+			if (!a->fill++)
+				a->x1 = a->x2 = a->y1 = a->y2 = x;
+			acc = (int64_t)f->c[0] * x + (int64_t)f->c[1] * a->x1 + (int64_t)f->c[2] * a->x2 -
+			      (int64_t)f->c[3] * a->y1 - (int64_t)f->c[4] * a->y2;
+			y = (int32_t)((acc + (1 << (MM_FIXED_RADIX - 1))) >> MM_FIXED_RADIX);
+			a->x2 = a->x1;
+			a->x1 = x;
+			a->y2 = a->y1;
+			a->y1 = y;
+			return y;
+	}
+
+	return x;
+}
+
+static inline int16_t filter_out(int32_t v)
+{
+	v = (v + (1 << (FILTER_SHIFT - 1))) >> FILTER_SHIFT;
+	return v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+}
+
+void filter_chain_run(struct filter_chain * chain, int16_t * x, int16_t * y, int16_t * z)
+{
+	int32_t v[3];
+	int i, j;
+
+	v[0] = *x * (1 << FILTER_SHIFT);
+	v[1] = *y * (1 << FILTER_SHIFT);
+	v[2] = *z * (1 << FILTER_SHIFT);
+
+	for (i=0;i<chain->stages;i++)
+		for (j=0;j<3;j++)
+			v[j] = filter_step(&chain->stage[i], &chain->stage[i].axis[j], v[j]);
+
+	*x = filter_out(v[0]);
+	*y = filter_out(v[1]);
+	*z = filter_out(v[2]);
+}
+
+int decimator_init(struct decimator * d, int ratio, int order)
+{
+	int i;
+
+	if (ratio < 1 || ratio > DECIMATE_MAX_RATIO || order < 1 || order > DECIMATE_MAX_ORDER)
+		return -1;
+
+	memset(d, 0, sizeof(*d));
+	d->ratio = ratio;
+	d->order = order;
+	d->gain = 1;
+	for (i=0;i<order;i++)
+		d->gain *= ratio;
+
+	return 0;
+}
+
+void decimator_reset(struct decimator * d)
+{
+	d->phase = 0;
+	d->primed = 0;
+	memset(d->integ, 0, sizeof(d->integ));
+	memset(d->comb, 0, sizeof(d->comb));
+}
+
+/* integrate one input sample, return the last integrator */
+static inline uint64_t decimator_integrate(struct decimator * d, int axis, int32_t x)
+{
+	uint64_t v = (uint64_t)(int64_t)x;
+	int i;
+
+	for (i=0;i<d->order;i++)
+		v = d->integ[axis][i] += v;
+	return v;
+}
+
+/* the output is N^K times the input at most, back in range of int64_t */
+static inline int64_t decimator_comb(struct decimator * d, int axis, uint64_t v)
+{
+	uint64_t prev;
+	int i;
+
+	for (i=0;i<d->order;i++) {
+		prev = d->comb[axis][i];
+		d->comb[axis][i] = v;
+		v -= prev;
+	}
+	return (int64_t)v;
+}
+
+static inline int16_t decimator_out(struct decimator * d, int64_t v)
+{
+	v = v >= 0 ? (v + d->gain / 2) / d->gain : -((-v + d->gain / 2) / d->gain);
+	return v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+}
+
+int decimator_run(struct decimator * d, int16_t * x, int16_t * y, int16_t * z)
+{
+	int16_t * v[3] = { x, y, z };
+	uint64_t out[3];
+	int i, j;
+
+	/* start as if the first sample had always been there, instead of
+	 * ramping up from zero over K outputs */
+	if (!d->primed) {
+		for (i=0;i<d->order * d->ratio;i++) {
+			for (j=0;j<3;j++) {
+				out[j] = decimator_integrate(d, j, *v[j]);
+				if (i % d->ratio == d->ratio - 1)
+					decimator_comb(d, j, out[j]);
+			}
+		}
+		d->primed = 1;
+	}
+
+	for (j=0;j<3;j++)
+		out[j] = decimator_integrate(d, j, *v[j]);
+	if (++d->phase < d->ratio)
+		return 0;
+	d->phase = 0;
+
+	for (j=0;j<3;j++)
+		*v[j] = decimator_out(d, decimator_comb(d, j, out[j]));
+	return 1;
+}
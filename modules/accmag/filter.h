@@ -0,0 +1,148 @@
+/**
+ *  @file filter.h
+ *
+ *  Fixed point filter chains for accmag samples.
+ *
+ *  A chain is described by a string of comma separated stages, applied
+ *  in order to each axis:
+ *
+ *  	lowpass <alpha>			one pole, y += alpha * (x - y), 0 < alpha <= 1
+ *  	average <n>			moving average over n samples
+ *  	median <n>			median of the last n samples
+ *  	biquad <b0> <b1> <b2> <a1> <a2>	direct form I, a0 normalized to 1
+ *
+ *  e.g. "median 5, lowpass 0.25". Coefficients are converted to 16.16
+ *  once, samples are filtered with 8 fraction bits in integer math.
+ *
+ *  A decimator reduces the sample rate by an integer ratio N with a
+ *  cascaded integrator comb filter of order K: K running sums at the
+ *  input rate, K differences at the output rate, divided by the gain
+ *  N^K. Order 1 is the average of each N samples, higher orders
+ *  suppress aliases further at the cost of a longer delay.
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ACCMAG_FILTER_H
+#define ACCMAG_FILTER_H
+
+#include <stdint.h>
+
+#include <platform/fixed.h>
+
+/* longest average or median window */
+#define FILTER_MAX_TAPS		32
+
+/* fraction bits of the samples inside a chain */
+#define FILTER_SHIFT		8
+
+enum filter_type {
+	FILTER_LOWPASS,
+	FILTER_AVERAGE,
+	FILTER_MEDIAN,
+	FILTER_BIQUAD,
+};
+
+/**
+ * State of one stage for one axis.
+ */
+struct filter_axis {
+	int32_t hist[FILTER_MAX_TAPS];	/**< Window of average and median */
+	int pos;			/**< Next slot of hist */
+	int fill;			/**< Samples in hist, or seen at all */
+	int64_t sum;			/**< Running sum of the average */
+	int32_t x1, x2, y1, y2;		/**< Biquad and lowpass history */
+};
+
+/**
+ * A stage of a chain.
+ */
+struct filter {
+	enum filter_type type;
+	int taps;			/**< Window length */
+	mm_fixed_t c[5];		/**< alpha, or b0 b1 b2 a1 a2, 16.16 */
+	struct filter_axis axis[3];
+};
+
+struct filter_chain {
+	int stages;
+	struct filter * stage;
+};
+
+#define DECIMATE_MAX_RATIO	1024
+#define DECIMATE_MAX_ORDER	4
+
+struct decimator {
+	int ratio;			/**< N, input samples per output sample */
+	int order;			/**< K, number of integrator and comb pairs */
+	int phase;			/**< Input samples since the last output */
+	int primed;			/**< Integrators are in steady state */
+	int64_t gain;			/**< N^K */
+	/* modulo 2^64, the integrators wrap and the combs undo it */
+	uint64_t integ[3][DECIMATE_MAX_ORDER];	/**< Integrators per axis */
+	uint64_t comb[3][DECIMATE_MAX_ORDER];	/**< Previous comb inputs per axis */
+};
+
+/**
+ * Build a chain from its description.
+ *
+ * @return The chain, NULL if spec is empty or invalid
+ */
+struct filter_chain * filter_chain_parse(const char * spec);
+
+void filter_chain_free(struct filter_chain * chain);
+
+/**
+ * Forget the history, e.g. after the offsets changed.
+ */
+void filter_chain_reset(struct filter_chain * chain);
+
+/**
+ * Filter one sample in place.
+ */
+void filter_chain_run(struct filter_chain * chain, int16_t * x, int16_t * y, int16_t * z);
+
+/**
+ * Set up a decimator.
+ *
+ * @return 0 on success, -1 if ratio or order is out of range
+ */
+int decimator_init(struct decimator * d, int ratio, int order);
+
+/**
+ * Forget the history, e.g. after the offsets changed.
+ */
+void decimator_reset(struct decimator * d);
+
+/**
+ * Feed one sample.
+ *
+ * @return 1 with the decimated sample in place every ratio samples,
+ * 0 otherwise
+ */
+int decimator_run(struct decimator * d, int16_t * x, int16_t * y, int16_t * z);
+
+/**
+ * Delay of a decimated sample behind the last input, in input samples
+ * << 1, i.e. K (N - 1).
+ */
+static inline int decimator_delay2(const struct decimator * d)
+{
+	return d->order * (d->ratio - 1);
+}
+
+#endif /* ACCMAG_FILTER_H */
@@ -0,0 +1,428 @@
+/**
+ *  @file gesture.c
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "gesture.h"
+
+/* gravity follows the samples with weight 1 / (1 << GRAVITY_SHIFT) */
+#define GRAVITY_SHIFT	5
+
+/* warping band of the template match */
+#define DTW_BAND	(GESTURE_POINTS / 4)
+#define DTW_INF		0x3fffffffU
+
+static const char * tilt_names[] = {
+	[TILT_FLAT] = "tilt_flat",
+	[TILT_FORWARD] = "tilt_forward",
+	[TILT_BACK] = "tilt_back",
+	[TILT_LEFT] = "tilt_left",
+	[TILT_RIGHT] = "tilt_right",
+};
+
+static const struct {
+	const char * name;
+	enum gesture_detector detector;
+} detectors[] = {
+	{ "shake", GESTURE_SHAKE },
+	{ "tap", GESTURE_TAP },
+	{ "tilt", GESTURE_TILT },
+};
+
+int gesture_detectors(const char * list)
+{
+	char copy[128], * tok, * save;
+	unsigned int i;
+	int bits = 0;
+
+	snprintf(copy, sizeof(copy), "%s", list);
+	for (tok = strtok_r(copy, " \t,", &save); tok; tok = strtok_r(NULL, " \t,", &save)) {
+		for (i=0;i<sizeof(detectors)/sizeof(detectors[0]);i++)
+			if (!strcmp(tok, detectors[i].name))
+				break;
+		if (i == sizeof(detectors)/sizeof(detectors[0]))
+			return -1;
+		bits |= detectors[i].detector;
+	}
+
+	return bits;
+}
+
+/* linear interpolation of n samples onto GESTURE_POINTS */
+static void gesture_resample(const int16_t (*src)[3], int n, int16_t (*dst)[3])
+{
+	int i, k, idx, frac;
+	int32_t pos;
+
+	for (i=0;i<GESTURE_POINTS;i++) {
+		pos = (int32_t)(((int64_t)i * (n - 1) << 8) / (GESTURE_POINTS - 1));
+		idx = pos >> 8;
+		frac = pos & 0xff;
+		for (k=0;k<3;k++) {
+			if (idx + 1 < n)
+				dst[i][k] = (int16_t)(src[idx][k] + (((src[idx+1][k] - src[idx][k]) * frac) >> 8));
+			else
+				dst[i][k] = src[n-1][k];
+		}
+	}
+}
+
+static int template_finish(struct gesture_config * config, int16_t (*raw)[3], int n,
+			   char * err, size_t size)
+{
+	struct gesture_template * t = &config->template[config->templates];
+
+	if (n < 4) {
+		snprintf(err, size, "template '%s' has %d samples, needs 4", t->name, n);
+		return -1;
+	}
+	gesture_resample((const int16_t (*)[3])raw, n, t->points);
+	config->templates++;
+	return 0;
+}
+
+int gesture_templates_load(struct gesture_config * config, const char * file,
+			   char * err, size_t size)
+{
+	int16_t (*raw)[3];
+	char line[256], name[SIOS_GESTURE_NAMESIZE];
+	int x, y, z, n = 0, open = 0, lineno = 0, first = config->templates;
+	unsigned int limit;
+	char * p;
+	FILE * f;
+
+	f = fopen(file, "r");
+	if (!f) {
+		snprintf(err, size, "can not open %s", file);
+		return -1;
+	}
+
+	/* parsing only, the engine never allocates per sample */
+	raw = (int16_t (*)[3])malloc(sizeof(int16_t) * 3 * GESTURE_MAX_SAMPLES);
+	if (!raw) {
+		fclose(f);
+		snprintf(err, size, "out of memory");
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		for (p = line; isspace((unsigned char)*p); p++)
+			;
+		if (!*p || *p == '#')
+			continue;
+
+		if (isalpha((unsigned char)*p) || *p == '_') {
+			if (open && template_finish(config, raw, n, err, size))
+				goto err;
+			open = 0;
+			if (config->templates == GESTURE_MAX_TEMPLATES) {
+				snprintf(err, size, "%s:%d: more than %d templates", file, lineno,
+					 GESTURE_MAX_TEMPLATES);
+				goto err;
+			}
+			if (sscanf(p, "%23s %u", name, &limit) != 2) {
+				snprintf(err, size, "%s:%d: expected name and limit", file, lineno);
+				goto err;
+			}
+			snprintf(config->template[config->templates].name, SIOS_GESTURE_NAMESIZE, "%s", name);
+			config->template[config->templates].limit = limit;
+			open = 1;
+			n = 0;
+			continue;
+		}
+
+		if (!open || sscanf(p, "%d %d %d", &x, &y, &z) != 3) {
+			snprintf(err, size, "%s:%d: expected x y z of a template", file, lineno);
+			goto err;
+		}
+		if (n == GESTURE_MAX_SAMPLES) {
+			snprintf(err, size, "%s:%d: more than %d samples", file, lineno,
+				 GESTURE_MAX_SAMPLES);
+			goto err;
+		}
+		raw[n][0] = x < -32768 ? -32768 : x > 32767 ? 32767 : x;
+		raw[n][1] = y < -32768 ? -32768 : y > 32767 ? 32767 : y;
+		raw[n][2] = z < -32768 ? -32768 : z > 32767 ? 32767 : z;
+		n++;
+	}
+	if (open && template_finish(config, raw, n, err, size))
+		goto err;
+
+	free(raw);
+	fclose(f);
+	return config->templates - first;
+
+err:
+	config->templates = first;
+	free(raw);
+	fclose(f);
+	return -1;
+}
+
+int gesture_engine_init(struct gesture_engine * e, const struct gesture_config * config)
+{
+	double s = sin(config->tilt_angle * M_PI / 180.0);
+
+	memset(e, 0, sizeof(*e));
+	e->config = config;
+	e->tilt_limit = (int64_t)(s * s * (1 << 30));
+	if (config->templates) {
+		e->record = (int16_t (*)[3])malloc(sizeof(int16_t) * 3 * GESTURE_MAX_SAMPLES);
+		if (!e->record)
+			return -1;
+	}
+
+	return 0;
+}
+
+void gesture_engine_free(struct gesture_engine * e)
+{
+	free(e->record);
+	e->record = NULL;
+}
+
+void gesture_engine_reset(struct gesture_engine * e)
+{
+	const struct gesture_config * config = e->config;
+	int16_t (*record)[3] = e->record;
+	int64_t tilt_limit = e->tilt_limit;
+
+	memset(e, 0, sizeof(*e));
+	e->config = config;
+	e->record = record;
+	e->tilt_limit = tilt_limit;
+}
+
+static inline int64_t square(int64_t v)
+{
+	return v * v;
+}
+
+/* shake and tap, from bursts of motion */
+static const char * gesture_bursts(struct gesture_engine * e, int64_t motion, uint64_t stamp)
+{
+	const struct gesture_config * c = e->config;
+	int i, n;
+
+	if (!e->above && motion > square(c->shake_threshold)) {
+		e->above = 1;
+		e->burst_start = stamp;
+		e->burst_peak = motion;
+		e->tap = 0;
+
+		e->bursts[e->burst] = stamp;
+		e->burst = (e->burst + 1) % SHAKE_COUNT;
+		for (i=0, n=0;i<SHAKE_COUNT;i++)
+			if (e->bursts[i] && stamp - e->bursts[i] <= SHAKE_WINDOW)
+				n++;
+		if ((c->detectors & GESTURE_SHAKE) && n == SHAKE_COUNT) {
+			memset(e->bursts, 0, sizeof(e->bursts));
+			e->recording = 0;
+			return "shake";
+		}
+	} else if (e->above) {
+		if (motion > e->burst_peak)
+			e->burst_peak = motion;
+		if (motion <= square(c->shake_threshold)) {
+			e->above = 0;
+			/* the last burst of a shake is no tap */
+			for (i=0, n=0;i<SHAKE_COUNT;i++)
+				if (e->bursts[i] && stamp - e->bursts[i] <= SHAKE_WINDOW)
+					n++;
+			if (n <= 1 && stamp - e->burst_start <= TAP_MAX &&
+			    e->burst_peak > square(c->tap_threshold))
+				e->tap = stamp;
+		}
+	}
+
+	/* a tap is only a tap if nothing follows */
+	if (e->tap && stamp - e->tap > TAP_QUIET) {
+		e->tap = 0;
+		if (c->detectors & GESTURE_TAP)
+			return "tap";
+	}
+
+	return NULL;
+}
+
+static uint32_t gesture_dtw(const int16_t (*a)[3], const int16_t (*b)[3])
+{
+	uint32_t prev[GESTURE_POINTS + 1], cur[GESTURE_POINTS + 1], best, cost;
+	int i, j;
+
+	prev[0] = 0;
+	for (j=1;j<=GESTURE_POINTS;j++)
+		prev[j] = DTW_INF;
+
+	for (i=1;i<=GESTURE_POINTS;i++) {
+		cur[0] = DTW_INF;
+		for (j=1;j<=GESTURE_POINTS;j++) {
+			if (i - j > DTW_BAND || j - i > DTW_BAND) {
+				cur[j] = DTW_INF;
+				continue;
+			}
+			cost = abs(a[i-1][0] - b[j-1][0]) + abs(a[i-1][1] - b[j-1][1]) +
+			       abs(a[i-1][2] - b[j-1][2]);
+			best = prev[j - 1];
+			if (prev[j] < best)
+				best = prev[j];
+			if (cur[j - 1] < best)
+				best = cur[j - 1];
+			cur[j] = best >= DTW_INF ? DTW_INF : best + cost;
+		}
+		memcpy(prev, cur, sizeof(prev));
+	}
+
+	return prev[GESTURE_POINTS];
+}
+
+/* the best template below its limit, NULL if none */
+static const char * gesture_match(struct gesture_engine * e)
+{
+	const struct gesture_config * c = e->config;
+	int16_t points[GESTURE_POINTS][3];
+	const char * name = NULL;
+	uint32_t d, best = DTW_INF;
+	int i;
+
+	gesture_resample((const int16_t (*)[3])e->record, e->moving, points);
+	for (i=0;i<c->templates;i++) {
+		d = gesture_dtw((const int16_t (*)[3])points,
+				(const int16_t (*)[3])c->template[i].points) / GESTURE_POINTS;
+		if (d <= c->template[i].limit && d < best) {
+			best = d;
+			name = c->template[i].name;
+		}
+	}
+
+	return name;
+}
+
+/* record movements and match them when they end */
+static const char * gesture_templates(struct gesture_engine * e, const int32_t * d,
+				      int64_t motion, uint64_t stamp)
+{
+	int moving = motion > square(e->config->motion_threshold);
+	int k;
+
+	if (!e->recording) {
+		if (!moving)
+			return NULL;
+		e->recording = 1;
+		e->samples = e->moving = 0;
+	}
+
+	if (e->samples == GESTURE_MAX_SAMPLES) {
+		/* too long for a gesture, wait for rest */
+		if (!moving)
+			e->recording = 0;
+		return NULL;
+	}
+
+	for (k=0;k<3;k++)
+		e->record[e->samples][k] = d[k] < -32768 ? -32768 : d[k] > 32767 ? 32767 : d[k];
+	e->samples++;
+	if (moving) {
+		e->moving = e->samples;
+		e->still_since = 0;
+		return NULL;
+	}
+
+	if (!e->still_since)
+		e->still_since = stamp;
+	if (stamp - e->still_since < MOTION_QUIET)
+		return NULL;
+
+	e->recording = 0;
+	return e->moving >= 4 ? gesture_match(e) : NULL;
+}
+
+static const char * gesture_tilt(struct gesture_engine * e, int64_t motion, uint64_t stamp)
+{
+	int64_t gx = e->gravity[0] >> 8, gy = e->gravity[1] >> 8, gz = e->gravity[2] >> 8;
+	int64_t limit = ((square(gx) + square(gy) + square(gz)) * e->tilt_limit) >> 30;
+	enum gesture_tilt tilt = TILT_FLAT;
+
+	/* gravity is not to be trusted while moving */
+	if (motion > square(e->config->motion_threshold))
+		return NULL;
+
+	if (square(gx) > limit && square(gx) >= square(gy))
+		tilt = gx > 0 ? TILT_FORWARD : TILT_BACK;
+	else if (square(gy) > limit)
+		tilt = gy > 0 ? TILT_LEFT : TILT_RIGHT;
+
+	if (tilt != e->tilt_next) {
+		e->tilt_next = tilt;
+		e->tilt_since = stamp;
+	}
+	if (e->tilt_next != e->tilt && stamp - e->tilt_since >= TILT_HOLD) {
+		e->tilt = e->tilt_next;
+		return tilt_names[e->tilt];
+	}
+
+	return NULL;
+}
+
+const char * gesture_run(struct gesture_engine * e, int16_t x, int16_t y, int16_t z,
+			 uint64_t stamp)
+{
+	const struct gesture_config * c = e->config;
+	int32_t v[3] = { x, y, z }, d[3];
+	const char * name = NULL, * n;
+	int64_t motion = 0;
+	int k;
+
+	for (k=0;k<3;k++) {
+		if (!e->primed)
+			e->gravity[k] = v[k] * 256;
+		e->gravity[k] += (v[k] * 256 - e->gravity[k]) >> GRAVITY_SHIFT;
+		d[k] = v[k] - (e->gravity[k] >> 8);
+		motion += square(d[k]);
+	}
+	e->primed = 1;
+
+	if (c->detectors & (GESTURE_SHAKE | GESTURE_TAP))
+		name = gesture_bursts(e, motion, stamp);
+	if (c->templates) {
+		n = gesture_templates(e, d, motion, stamp);
+		if (!name)
+			name = n;
+	}
+
+	if (name) {
+		if (e->last_fire && stamp - e->last_fire < GESTURE_REFRACTORY)
+			name = NULL;
+		else
+			e->last_fire = stamp;
+	}
+
+	/* states, not events, they do not wait for the refractory time. One
+	 * name per sample, a change waits for a sample that has room for it */
+	if ((c->detectors & GESTURE_TILT) && !name)
+		name = gesture_tilt(e, motion, stamp);
+
+	return name;
+}
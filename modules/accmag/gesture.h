@@ -0,0 +1,159 @@
+/**
+ *  @file gesture.h
+ *
+ *  Gesture recognition on accmag acc samples, all in integer math.
+ *
+ *  Gravity is tracked by a slow lowpass, the rest of each sample is
+ *  motion. Threshold detectors look at the motion:
+ *
+ *  	shake	SHAKE_COUNT motion bursts over shake_threshold within SHAKE_WINDOW
+ *  	tap	a single burst over tap_threshold shorter than TAP_MAX
+ *  	tilt	gravity more than tilt_angle off the z axis, held for TILT_HOLD,
+ *  		as tilt_forward/tilt_back (x) or tilt_left/tilt_right (y),
+ *  		and tilt_flat when it comes back
+ *
+ *  Templates match whole movements: motion over motion_threshold starts
+ *  a recording, MOTION_QUIET of rest ends it. The recording is resampled
+ *  to GESTURE_POINTS and compared to every template by dynamic time
+ *  warping. The closest template fires if its mean distance per point
+ *  is below the template's limit. Templates are read from a text file:
+ *
+ *  	# comment
+ *  	swipe_right 300		name and limit, counts per point
+ *  	0 0 0			motion samples x y z, at least 4
+ *  	120 -10 5
+ *  	...
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ACCMAG_GESTURE_H
+#define ACCMAG_GESTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <platform/sios_shm.h>
+
+/* times in microseconds */
+#define SHAKE_COUNT		4
+#define SHAKE_WINDOW		800000
+#define TAP_MAX			120000
+#define TAP_QUIET		250000
+#define TILT_HOLD		300000
+#define MOTION_QUIET		150000
+#define GESTURE_REFRACTORY	500000
+
+#define GESTURE_POINTS		32	/* template and recording length for matching */
+#define GESTURE_MAX_SAMPLES	256	/* longest recording and template */
+#define GESTURE_MAX_TEMPLATES	16
+
+enum gesture_detector {
+	GESTURE_SHAKE	= 1,
+	GESTURE_TAP	= 2,
+	GESTURE_TILT	= 4,
+};
+
+struct gesture_template {
+	char name[SIOS_GESTURE_NAMESIZE];
+	uint32_t limit;				/**< Mean distance per point to fire */
+	int16_t points[GESTURE_POINTS][3];	/**< Resampled motion */
+};
+
+struct gesture_config {
+	unsigned int detectors;			/**< enum gesture_detector bits */
+	int tap_threshold;			/**< Counts */
+	int shake_threshold;			/**< Counts */
+	int motion_threshold;			/**< Counts */
+	int tilt_angle;				/**< Degrees */
+	int templates;				/**< Number of templates */
+	struct gesture_template template[GESTURE_MAX_TEMPLATES];
+};
+
+enum gesture_tilt {
+	TILT_FLAT,
+	TILT_FORWARD,
+	TILT_BACK,
+	TILT_LEFT,
+	TILT_RIGHT,
+};
+
+struct gesture_engine {
+	const struct gesture_config * config;
+	int32_t gravity[3];			/**< Lowpass, 8 fraction bits */
+	int primed;				/**< gravity holds a sample */
+	uint64_t last_fire;			/**< When a gesture last fired */
+
+	/* shake and tap */
+	int above;				/**< Motion is over shake_threshold */
+	uint64_t burst_start;			/**< When it went over */
+	int64_t burst_peak;			/**< Largest squared motion of the burst */
+	uint64_t bursts[SHAKE_COUNT];		/**< Start of the last bursts, a ring */
+	int burst;				/**< Next slot of bursts */
+	uint64_t tap;				/**< End of a tap waiting for quiet, 0 for none */
+
+	/* tilt */
+	enum gesture_tilt tilt;			/**< Reported state */
+	enum gesture_tilt tilt_next;		/**< Candidate state */
+	uint64_t tilt_since;			/**< When the candidate came up */
+	int64_t tilt_limit;			/**< sin^2 of tilt_angle, Q30 */
+
+	/* templates */
+	int recording;
+	int samples, moving;			/**< Recorded samples, up to the last moving one */
+	uint64_t still_since;			/**< Start of the rest ending a recording */
+	int16_t (*record)[3];			/**< GESTURE_MAX_SAMPLES samples */
+};
+
+/**
+ * Parse the detector list, e.g. "shake tap tilt".
+ *
+ * @return The enum gesture_detector bits, -1 on an unknown name
+ */
+int gesture_detectors(const char * list);
+
+/**
+ * Add the templates of a file to config.
+ *
+ * @return Number of templates added, -1 if the file can not be read or
+ * is invalid, with a message in err of at most size bytes
+ */
+int gesture_templates_load(struct gesture_config * config, const char * file,
+			   char * err, size_t size);
+
+/**
+ * @return 0 on success, -1 if out of memory
+ */
+int gesture_engine_init(struct gesture_engine * e, const struct gesture_config * config);
+
+void gesture_engine_free(struct gesture_engine * e);
+
+/**
+ * Forget everything but the configuration.
+ */
+void gesture_engine_reset(struct gesture_engine * e);
+
+/**
+ * Feed an acc sample.
+ *
+ * @param stamp Capture time, microseconds
+ * @return The name of a gesture that fired, NULL if none
+ */
+const char * gesture_run(struct gesture_engine * e, int16_t x, int16_t y, int16_t z,
+			 uint64_t stamp);
+
+#endif /* ACCMAG_GESTURE_H */
@@ -63,6 +63,9 @@ struct light_dev
 
 	uint16_t current;
 
+	/* protects the state above, OSC handlers may run in several threads */
+	pthread_mutex_t lock;
+
 	struct sios_source_ctx ctx;
 	struct sios_source_ctx flash_ctx;
 };
@@ -128,9 +131,11 @@ static void flash(u_short dev, u_short intensity, int duration)
 	
 	dbg("flash(%d): 0x%x (duration: %d)", dev, intensity, duration);
 
+	pthread_mutex_lock(&light_devs[dev].lock);
 	light_devs[dev].flash.state = FLASH;
 	light_devs[dev].flash.intensity = intensity;
 	light_devs[dev].flash.delay = duration * 1000;;
+	pthread_mutex_unlock(&light_devs[dev].lock);
 	
 	sios_add_source_ctx(&light_devs[dev].flash_ctx);
 }
@@ -145,9 +150,11 @@ static inline void light_put_color(u_short dev, u_short r, u_short g, u_short b)
 	
 	SET_TYPE(color, TYPE_RGB);
 	COLOR_RGB(color, r, g, b);	
+	pthread_mutex_lock(&light_devs[dev].lock);
 	light_devs[dev].state = SINGLE;
 	light_devs[dev].data.color.rgb = color;
 	light_devs[dev].data.color.delay = WRITE_MIN_DELAY;
+	pthread_mutex_unlock(&light_devs[dev].lock);
 	
 	sios_add_source_ctx(&light_devs[dev].ctx);
 }
@@ -189,6 +196,7 @@ static void compute_blink_steps(u_short dev, u_short r1, u_short g1, u_short b1,
 	sg = (dg) ? (maxd + 1) / dg : 0;
 	sb = (db) ? (maxd + 1) / db : 0;
 	
+	pthread_mutex_lock(&light_devs[dev].lock);
 	SET_TYPE(light_devs[dev].data.trans.rgb[0], TYPE_RGB);
 	COLOR_RGB(light_devs[dev].data.trans.rgb[0], r1, g1, b1);
 	SET_TYPE(light_devs[dev].data.trans.rgb[maxd], TYPE_RGB);
@@ -226,6 +234,7 @@ static void compute_blink_steps(u_short dev, u_short r1, u_short g1, u_short b1,
 	light_devs[dev].data.trans.step = 1;
 	light_devs[dev].data.trans.direction = 1;
 	light_devs[dev].data.trans.delay = (duration / maxd) * 1000;
+	pthread_mutex_unlock(&light_devs[dev].lock);
 	
 	sios_add_source_ctx(&light_devs[dev].ctx);
 }
@@ -374,7 +383,7 @@ static int dev_flash_write(struct sios_source_ctx * ctx, enum sios_event_type ac
 	struct light_dev * dev;
 	uint16_t flash;
 	unsigned char data[2];
-	int retval;
+	int retval, done;
 
 	//dbg("in flash");
 	dev = (struct light_dev*)ctx->priv;
@@ -382,6 +391,7 @@ static int dev_flash_write(struct sios_source_ctx * ctx, enum sios_event_type ac
 	if (action != SIOS_EVENT_WRITE)
 		return 0;
 	
+	pthread_mutex_lock(&dev->lock);
 	if (dev->flash.state == FLASH) {
 		//dbg("FLASH");
 		SET_TYPE(flash, TYPE_SUB);
@@ -395,6 +405,8 @@ static int dev_flash_write(struct sios_source_ctx * ctx, enum sios_event_type ac
 		dev->flash_ctx.period = WRITE_MIN_DELAY;
 		dev->flash.state = FLASH;
 	}
+	done = dev->flash.state;
+	pthread_mutex_unlock(&dev->lock);
 
 	data[0] = (unsigned char)(flash >> 8);
 	data[1] = (unsigned char)(flash & 0x00FF);
@@ -409,7 +421,7 @@ static int dev_flash_write(struct sios_source_ctx * ctx, enum sios_event_type ac
 	}
 	//dbg("post flash write");
 
-	return dev->flash.state;
+	return done;
 }
 
 static int dev_light_write(struct sios_source_ctx * ctx, enum sios_event_type action) 
@@ -426,6 +438,7 @@ static int dev_light_write(struct sios_source_ctx * ctx, enum sios_event_type ac
 	if (action != SIOS_EVENT_WRITE)
 		return 0;
 
+	pthread_mutex_lock(&dev->lock);
 	switch (dev->state) {
 		case SINGLE:
 			//dbg("single");
@@ -447,6 +460,7 @@ static int dev_light_write(struct sios_source_ctx * ctx, enum sios_event_type ac
 			avance_next_blink_color(dev);
 			break;
 	}
+	pthread_mutex_unlock(&dev->lock);
 	
 	data[0] = (unsigned char)(color >> 8);
 	data[1] = (unsigned char)(color & 0x00FF);
@@ -501,6 +515,7 @@ static int init_devices(int numdevs)
 		}
 
 		light_devs[i].num = i;
+		pthread_mutex_init(&light_devs[i].lock, NULL);
 
 		light_devs[i].ctx.self = THIS_MODULE;
 		light_devs[i].ctx.type = SIOS_POLL_WRITE;
@@ -523,10 +538,10 @@ static int init_devices(int numdevs)
 }
 
 static struct sios_method_desc osc_methods[] = {
-	METHOD_DESC_INITIALIZER("rgb", "", NULL, color_rgb_handler, "set rgb color"),
-	METHOD_DESC_INITIALIZER("blink", "", NULL, color_blink_handler, "blink colors"),
-	METHOD_DESC_INITIALIZER("trans", "", NULL, color_trans_handler, "smooth fading to color"),
-	METHOD_DESC_INITIALIZER("flash", "", NULL, color_flash_handler, "flash"),
+	ACTUATOR_DESC_INITIALIZER("rgb", "", NULL, color_rgb_handler, "set rgb color"),
+	ACTUATOR_DESC_INITIALIZER("blink", "", NULL, color_blink_handler, "blink colors"),
+	ACTUATOR_DESC_INITIALIZER("trans", "", NULL, color_trans_handler, "smooth fading to color"),
+	ACTUATOR_DESC_INITIALIZER("flash", "", NULL, color_flash_handler, "flash"),
 };
 
 
@@ -9,6 +9,8 @@
 #include <platform/sios.h>
 #include <platform/module.h>
 #include <platform/util.h>
+#include <platform/stream.h>
+#include <platform/frame.h>
 
 #define MATRIX_DEV	"/dev/sios_matrix"
 #define MAX_CELLS	64
@@ -22,144 +24,101 @@ SET_MODULE_VERSION(1, 0, 2)
 static char device[36] = MATRIX_DEV;
 static int rows = MAX_ROWS;
 static int cols = MAX_COLS;
+static int keyframe_interval = 100;
+static int delta_threshold = 0;
 static unsigned char buf[BUFSIZE];
 
 sios_param(rows, int, rows);
 sios_param(cols, int, cols);
+sios_param(keyframe_interval, int, keyframe_interval);
+sios_param(delta_threshold, int, delta_threshold);
 sios_param_string(device, device, 36);
 
 static char * matrix_path[] = { "/sios/sensors/matrix/data" };
 
-static uint16_t matrix_data[MAX_CELLS];
+static struct sios_stream stream;
+static struct sios_frame_delta delta;
+
+/* OSC argument order of the 4x16 layout, as sensor cell numbers */
+static const unsigned char layout_4x16[MAX_CELLS] = {
+	63,55,47,39,31,23,15,7, 59,51,43,35,27,19,11,3,
+	62,54,48,38,30,22,14,6, 58,50,42,34,26,18,10,2,
+	61,53,47,37,29,21,13,5, 57,49,41,33,25,17,9, 1,
+	60,52,46,36,28,19,12,4, 56,48,40,32,24,16,8, 0,
+};
 
-LIST_HEAD(listen_list);
-static pthread_mutex_t listener_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_t matrix_reader_loop_thread;
 static pthread_mutex_t halt_lock = PTHREAD_MUTEX_INITIALIZER;
 static int halt = 0;
 
-static int add_listener(lo_address addr)
+/* cells in OSC argument order, blob formats are described in frame.h */
+static int matrix_encode_blob(struct sios_stream * stream, const uint16_t * cells,
+			      const struct sios_stream_sample * sample,
+			      enum sios_stream_format format, lo_message msg)
 {
-	struct listener * l; 
-
-	if (!addr)
-		return -1;
-
-	pthread_mutex_lock(&listener_lock);
-	list_for_each_entry(l, &listen_list, listener) {
-		if (!strcmp(lo_address_get_hostname(addr), lo_address_get_hostname(l->address)) &&
-				!strcmp(lo_address_get_port(addr), lo_address_get_port(l->address))) {
-			info(MODULE_NAME, "matrix: %s:%s already a listener", 
-					  lo_address_get_hostname(addr),
-					  lo_address_get_port(addr));
-			pthread_mutex_unlock(&listener_lock);
-			return -1;
+	unsigned char data[SIOS_FRAME_B16_SIZE(MAX_CELLS)];
+	uint32_t key_frame;
+	lo_blob blob;
+	int len;
+
+	if (format == SIOS_STREAM_B16) {
+		len = sios_frame_pack16(data, cells, MAX_CELLS);
+	} else if (format == SIOS_STREAM_B12) {
+		len = sios_frame_pack12(data, cells, MAX_CELLS);
+	} else {
+		/* called with the stream lock held, like all encoders */
+		if (stream->keyframe) {
+			delta.force = 1;
+			stream->keyframe = 0;
 		}
+		len = sios_frame_delta_encode(&delta, data, cells, sample->seq, &key_frame);
 	}
 
-	l = (struct listener*)malloc(sizeof(struct listener));
-	if (!l) {
-		pthread_mutex_unlock(&listener_lock);
+	blob = lo_blob_new(len, data);
+	if (!blob)
 		return -1;
-	}
-
-	INIT_LIST_HEAD(&l->listener);
-	l->address = addr;
-	list_add(&l->listener, &listen_list);
 
-	pthread_mutex_unlock(&listener_lock);
+	lo_message_add_int32(msg, sample->seq);
+	if (format == SIOS_STREAM_DELTA)
+		lo_message_add_int32(msg, key_frame);
+	lo_message_add_timetag(msg, sios_stream_timetag(sample));
+	lo_message_add_blob(msg, blob);
+	/* the message keeps a copy */
+	lo_blob_free(blob);
 
-	info(MODULE_NAME, "sending matrix data to: %s:%s", lo_address_get_hostname(addr), 
-	 						     lo_address_get_port(addr));
-	
 	return 0;
 }
 
-static void del_listener(lo_address addr)
-{
-	struct listener * l; 
-	int found = 0;
-
-	if (!addr) return;
-
-	pthread_mutex_lock(&listener_lock);
-	list_for_each_entry(l, &listen_list, listener) {
-		if (!strcmp(lo_address_get_hostname(addr), lo_address_get_hostname(l->address)) &&
-				!strcmp(lo_address_get_port(addr), lo_address_get_port(l->address))) {
-			found = 1;
-			break;
-		}
-	}
-
-	if (found) {
-		info(MODULE_NAME, "stop sending matrix data to: %s:%s", lo_address_get_hostname(l->address), 
-							       		  lo_address_get_port(l->address));
-		list_del(&l->listener);
-		lo_address_free(l->address);
-		free(l);
-	}
-
-	pthread_mutex_unlock(&listener_lock);
-}
-
-static int add_matrix_listen_source_handler(const char *path, const char *types, lo_arg **argv, 
-			      int argc, lo_message msg, void *user_data)
+static int matrix_encode(struct sios_stream * stream, const void * record,
+			 const struct sios_stream_sample * sample,
+			 enum sios_stream_format format, lo_message msg)
 {
-	lo_address addr, t = lo_message_get_source(msg);
-
-	if (argc < 2) {
-		info(MODULE_NAME, "adding from source");
-		addr = lo_address_new(lo_address_get_hostname(t), lo_address_get_port(t));
+	const struct sios_shm_matrix * r = (const struct sios_shm_matrix*)record;
+	uint16_t cells[MAX_CELLS];
+	int i;
+
+	if (rows == 8 && cols == 8) {
+		memcpy(cells, r->cells, sizeof(cells));
+	} else if (rows == 4 && cols == 16) {
+		for (i=0;i<MAX_CELLS;i++)
+			cells[i] = r->cells[layout_4x16[i]];
 	} else {
-		info(MODULE_NAME, "adding from args %s", types);
-		if (types[1] == 'i') {
-			char port[6];
-			snprintf(port, 6, "%d", argv[1]->i);
-			addr = lo_address_new(&argv[0]->s, port);
-		} else {
-			addr = lo_address_new(&argv[0]->s, &argv[1]->s);
-		}
-	}
-
-	if (add_listener(addr)) {
-		lo_address_free(addr);
 		return -1;
 	}
 
-	return 0;
-}
+	if (format != SIOS_STREAM_INT)
+		return matrix_encode_blob(stream, cells, sample, format, msg);
 
-static int del_matrix_listen_source_handler(const char *path, const char *types, lo_arg **argv, 
-			      int argc, lo_message msg, void *user_data)
-{
-	lo_address addr, t = lo_message_get_source(msg);
+	for (i=0;i<MAX_CELLS;i++)
+		lo_message_add_int32(msg, cells[i]);
 
-	if (argc < 2) {
-		info(MODULE_NAME, "delling from source");
-		addr = lo_address_new(lo_address_get_hostname(t), lo_address_get_port(t));
-	} else {
-		info(MODULE_NAME, "delling from args %s", types);
-		if (types[1] == 'i') {
-			char port[6];
-			snprintf(port, 6, "%d", argv[1]->i);
-			addr = lo_address_new(&argv[0]->s, port);
-		} else {
-			addr = lo_address_new(&argv[0]->s, &argv[1]->s);
-		}	
-	}
-
-	del_listener(addr);
-	lo_address_free(addr);
 	return 0;
 }
 
-
-
 static int dev_matrix_read(struct sios_source_ctx * ctx, enum sios_event_type action) 
 {
-	struct listener * l;
 	static int ptr = 0;
-	int bytes, i,j;
+	int bytes, i;
 
 	if (action != SIOS_EVENT_READ)
 		return 0;
@@ -171,68 +130,17 @@ static int dev_matrix_read(struct sios_source_ctx * ctx, enum sios_event_type ac
 	} else if (bytes < BUFSIZE) {
 		ptr += bytes;
 	} else {
-		pthread_mutex_lock(&listener_lock);
-
-		if (!list_empty(&listen_list)) {
-#if 0
-			int i;
-			memcpy(matrix_data, buf, BUFSIZE);
-			lo_message msg = lo_message_new();
-			for (i=0;i<rows;i++) 
-				for (j=0;j<cols;j++) 
-					lo_message_add_int32(msg, ((unsigned int)matrix_data[i*MAX_COLS + j]) >> 4);
-			list_for_each_entry(l, &listen_list, listener) 
-				lo_send_message(l->address, matrix_path[0], msg);
-			lo_message_free(msg);
-#else
-			int v[64], i;
-			for (i=0;i<128;i+=2) {
-				v[i/2] = ((buf[i] << 8) | (buf[i+1] & 0x0ff)) & 0x0fff;
-			}
-/*
-			sios_osc_dispatch_all(  matrix_path[0], 
-					        "iiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiii",
-						v[0],v[1],v[2],v[3],v[4],v[5],v[6],v[7],
-						v[8],v[9],v[10],v[11],v[12],v[13],v[14],v[15],
-						v[16],v[17],v[18],v[19],v[20],v[21],v[22],v[23],
-						v[24],v[25],v[26],v[27],v[28],v[29],v[30],v[31],
-						v[32],v[33],v[34],v[35],v[36],v[37],v[38],v[39],
-						v[40],v[41],v[42],v[43],v[44],v[45],v[46],v[47],
-						v[48],v[49],v[50],v[51],v[52],v[53],v[54],v[55],
-						v[56],v[57],v[58],v[59],v[60],v[61],v[62],v[63]);
-
-*/
-			if (rows == 8 && cols == 8) {
-				list_for_each_entry(l, &listen_list, listener) {
-					lo_send(l->address, matrix_path[0], 
-						"iiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiii",
-						v[0],v[1],v[2],v[3],v[4],v[5],v[6],v[7],
-						v[8],v[9],v[10],v[11],v[12],v[13],v[14],v[15],
-						v[16],v[17],v[18],v[19],v[20],v[21],v[22],v[23],
-						v[24],v[25],v[26],v[27],v[28],v[29],v[30],v[31],
-						v[32],v[33],v[34],v[35],v[36],v[37],v[38],v[39],
-						v[40],v[41],v[42],v[43],v[44],v[45],v[46],v[47],
-						v[48],v[49],v[50],v[51],v[52],v[53],v[54],v[55],
-						v[56],v[57],v[58],v[59],v[60],v[61],v[62],v[63]);
-				}
-			} else if (rows == 4 && cols == 16) {
-				list_for_each_entry(l, &listen_list, listener) {
-					lo_send(l->address, matrix_path[0], 
-						"iiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiii",
-						v[63],v[55],v[47],v[39],v[31],v[23],v[15],v[7], v[59],v[51],v[43],v[35],v[27],v[19],v[11],v[3],
-						v[62],v[54],v[48],v[38],v[30],v[22],v[14],v[6], v[58],v[50],v[42],v[34],v[26],v[18],v[10],v[2],
-						v[61],v[53],v[47],v[37],v[29],v[21],v[13],v[5], v[57],v[49],v[41],v[33],v[25],v[17],v[9], v[1],
-						v[60],v[52],v[46],v[36],v[28],v[19],v[12],v[4], v[56],v[48],v[40],v[32],v[24],v[16],v[8], v[0]);
-				}
-			}
-#endif
-		}
+		struct sios_shm_matrix record;
 
-		pthread_mutex_unlock(&listener_lock);
+		/* always published, the stream keeps the latest frame */
+		for (i=0;i<BUFSIZE;i+=2) 
+			record.cells[i/2] = ((buf[i] << 8) | (buf[i+1] & 0x0ff)) & 0x0fff;
+		sios_stream_publish(&stream, &record);
 		
 		bzero(buf, BUFSIZE);
 		ptr = 0;
 	}
+
 	return 0;
 }
 
@@ -291,11 +199,6 @@ static struct sios_source_ctx dev_matrix_src = {
 	.handler = dev_matrix_read,
 };
 
-struct sios_method_desc osc_methods[] = {
-	METHOD_DESC_INITIALIZER("listen", "", NULL, add_matrix_listen_source_handler, "start data transfer"),
-	METHOD_DESC_INITIALIZER("silence", "", NULL, del_matrix_listen_source_handler, "stop data transfer"),
-};
-
 int matrix_init(void)
 {
 	int retval = 0;
@@ -319,7 +222,14 @@ int matrix_init(void)
 
 //	sios_object_can_have_listeners(THIS_MODULE);
 
-	retval = sios_osc_add_method_descs(osc_methods, METHOD_DESCRIPTORS(osc_methods));
+	sios_stream_init(&stream, THIS_MODULE, NULL, matrix_path[0],
+			 sizeof(struct sios_shm_matrix), matrix_encode);
+	stream.formats |= SIOS_STREAM_FORMAT_MASK(SIOS_STREAM_B12) |
+			  SIOS_STREAM_FORMAT_MASK(SIOS_STREAM_B16) |
+			  SIOS_STREAM_FORMAT_MASK(SIOS_STREAM_DELTA);
+	sios_frame_delta_init(&delta, MAX_CELLS, keyframe_interval > 0 ? keyframe_interval : 0,
+			      delta_threshold > 0 ? delta_threshold : 0);
+	retval = sios_stream_add_methods(&stream);
 
 	dev_matrix_src.self = THIS_MODULE;
 	dev_matrix_src.fd = fd;
@@ -349,6 +259,7 @@ void matrix_exit(void)
 
 	close_matrix_dev(dev_matrix_src.fd);
 	//sios_del_source_ctx(&dev_matrix_src);
+	sios_stream_exit(&stream);
 	sios_object_deregister(THIS_MODULE);
 }
 
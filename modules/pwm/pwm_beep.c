@@ -47,6 +47,8 @@ struct beep
 static struct beep beeps[PWM_BUFSIZE];
 static u_short	beep_head;
 static u_short	beep_tail;
+/* handlers may run concurrently in several OSC receiver threads */
+static pthread_mutex_t beep_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int pwm_has_beeps()
 {
@@ -274,6 +276,7 @@ static int PWMPutSweepBug(u_short f1, u_short f2, u_char d1, u_char d2, int freq
 static int pwm_beep_handler(const char *path, const char *types, lo_arg **argv, 
 			      int argc, lo_message msg, void *user_data)
 {
+	pthread_mutex_lock(&beep_lock);
 	switch(argc) {
 		case 3:
 			PWMPutBeep((u_char)argv[0]->i, (u_char)argv[1]->i, argv[2]->i);
@@ -284,6 +287,7 @@ static int pwm_beep_handler(const char *path, const char *types, lo_arg **argv,
 		default: 
 			warn(MODULE_NAME, "beep: wrong amount of arguments");
 	}
+	pthread_mutex_unlock(&beep_lock);
 	sios_add_source_ctx(&dev_pwm_beep_src);
 	return 0;
 }
@@ -292,6 +296,7 @@ static int pwm_sweep_handler(const char *path, const char *types, lo_arg **argv,
 			      int argc, lo_message msg, void *user_data)
 {
 	dbg("beep sweep");
+	pthread_mutex_lock(&beep_lock);
 	switch(argc) {
 		case 6:
 			PWMPutSweep((u_short)argv[0]->i, (u_short)argv[1]->i, (u_char)argv[2]->i, 
@@ -304,6 +309,7 @@ static int pwm_sweep_handler(const char *path, const char *types, lo_arg **argv,
 		default: 
 			warn(MODULE_NAME, "sweep: wrong amount of arguments");
 	}
+	pthread_mutex_unlock(&beep_lock);
 	sios_add_source_ctx(&dev_pwm_beep_src);
 	return 0;
 }
@@ -311,6 +317,7 @@ static int pwm_sweep_handler(const char *path, const char *types, lo_arg **argv,
 static int pwm_sweep_bug_handler(const char *path, const char *types, lo_arg **argv, 
 			      int argc, lo_message msg, void *user_data)
 {
+	pthread_mutex_lock(&beep_lock);
 	switch(argc) {
 		case 6:
 			PWMPutSweepBug((u_short)argv[0]->i, (u_short)argv[1]->i, (u_char)argv[2]->i, 
@@ -319,6 +326,7 @@ static int pwm_sweep_bug_handler(const char *path, const char *types, lo_arg **a
 		default: 
 			warn(MODULE_NAME, "sweep: wrong amount of arguments");
 	}
+	pthread_mutex_unlock(&beep_lock);
 	sios_add_source_ctx(&dev_pwm_beep_src);
 	return 0;
 }
@@ -330,9 +338,15 @@ static int dev_pwm_beep_write(struct sios_source_ctx * ctx, enum sios_event_type
 	int retval;
 	u_char out[7];
 
-	if (!(event & SIOS_EVENT_WRITE) || !pwm_has_beeps())
+	if (!(event & SIOS_EVENT_WRITE))
 		return 0;
 
+	pthread_mutex_lock(&beep_lock);
+	if (!pwm_has_beeps()) {
+		pthread_mutex_unlock(&beep_lock);
+		return 0;
+	}
+
 	beep = &beeps[beep_tail];
 	retval = write(ctx->fd, beep->data, beep->bytes);
 	if (retval < 0) 
@@ -342,8 +356,10 @@ static int dev_pwm_beep_write(struct sios_source_ctx * ctx, enum sios_event_type
 
 	if (pwm_has_beeps()) 
 		ctx->period = beeps[beep_tail].delay * 1000;
+	retval = !pwm_has_beeps();
+	pthread_mutex_unlock(&beep_lock);
 
-	return !pwm_has_beeps();
+	return retval;
 }
 
 static int open_pwm_dev(const char * dev)
@@ -362,9 +378,9 @@ static void close_pwm_dev(int fd)
 }
 
 struct sios_method_desc osc_methods[] = {
-	METHOD_DESC_INITIALIZER("beep", "", NULL, pwm_beep_handler, "send beep"),
-	METHOD_DESC_INITIALIZER("sweep", "", NULL, pwm_sweep_handler, "sweep to frequency"),
-	METHOD_DESC_INITIALIZER("sweepbug", "", NULL, pwm_sweep_bug_handler, "bugged version of sweep"),
+	ACTUATOR_DESC_INITIALIZER("beep", "", NULL, pwm_beep_handler, "send beep"),
+	ACTUATOR_DESC_INITIALIZER("sweep", "", NULL, pwm_sweep_handler, "sweep to frequency"),
+	ACTUATOR_DESC_INITIALIZER("sweepbug", "", NULL, pwm_sweep_bug_handler, "bugged version of sweep"),
 };
 
 int pwm_beep_init(void)
@@ -53,6 +53,8 @@ struct buzz
 static struct buzz buzzes[PWM_BUFSIZE];
 static u_short	buzz_head;
 static u_short	buzz_tail;
+/* handlers may run concurrently in several OSC receiver threads */
+static pthread_mutex_t buzz_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int pwm_has_buzzes()
 {
@@ -167,6 +169,7 @@ static int PWMPutSweep(u_char d1, u_char d2, int duration)
 static int pwm_buzz_handler(const char *path, const char *types, lo_arg **argv, 
 			      int argc, lo_message msg, void *user_data)
 {
+	pthread_mutex_lock(&buzz_lock);
 	switch(argc) {
 		case 1:
 			PWMPutBuzz((u_char)argv[0]->i, 1000);
@@ -177,6 +180,7 @@ static int pwm_buzz_handler(const char *path, const char *types, lo_arg **argv,
 		default: 
 			warn(MODULE_NAME, "pwm buzz: wrong amount of arguments");
 	}
+	pthread_mutex_unlock(&buzz_lock);
 	sios_add_source_ctx(&dev_pwm_buzz_src);
 	return 0;
 }
@@ -185,6 +189,7 @@ static int pwm_buzz_sweep_handler(const char *path, const char *types, lo_arg **
 			      	int argc, lo_message msg, void *user_data)
 {
 	dbg("buzz sweep");
+	pthread_mutex_lock(&buzz_lock);
 	switch(argc) {
 		case 3:
 			PWMPutSweep((u_char)argv[0]->i, (u_char)argv[1]->i, argv[2]->i);
@@ -192,6 +197,7 @@ static int pwm_buzz_sweep_handler(const char *path, const char *types, lo_arg **
 		default: 
 			warn(MODULE_NAME, "pwm buzz: wrong amount of arguments");
 	}
+	pthread_mutex_unlock(&buzz_lock);
 	sios_add_source_ctx(&dev_pwm_buzz_src);
 	return 0;
 }
@@ -203,9 +209,15 @@ static int dev_pwm_buzz_write(struct sios_source_ctx * ctx, enum sios_event_type
 	int retval;
 	u_char out[7];
 
-	if (action != SIOS_EVENT_WRITE || !pwm_has_buzzes())
+	if (action != SIOS_EVENT_WRITE)
 		return 0;
 
+	pthread_mutex_lock(&buzz_lock);
+	if (!pwm_has_buzzes()) {
+		pthread_mutex_unlock(&buzz_lock);
+		return 0;
+	}
+
 	buzz = &buzzes[buzz_tail];
 	retval = write(ctx->fd, buzz->data, buzz->bytes);
 	if (retval < 0) 
@@ -215,8 +227,10 @@ static int dev_pwm_buzz_write(struct sios_source_ctx * ctx, enum sios_event_type
 
 	if (pwm_has_buzzes())
 		ctx->period = buzzes[buzz_tail].delay * 1000;
+	retval = !pwm_has_buzzes();
+	pthread_mutex_unlock(&buzz_lock);
 
-	return !pwm_has_buzzes();
+	return retval;
 }
 
 static int open_pwm_dev(const char * dev)
@@ -251,8 +265,8 @@ static void close_pwm_dev(int fd)
 }
 
 struct sios_method_desc osc_methods[] = {
-	METHOD_DESC_INITIALIZER("buzz", "", NULL, pwm_buzz_handler, "put buzz"),
-	METHOD_DESC_INITIALIZER("sweep", "", NULL, pwm_buzz_sweep_handler, "put sweep buzz"),
+	ACTUATOR_DESC_INITIALIZER("buzz", "", NULL, pwm_buzz_handler, "put buzz"),
+	ACTUATOR_DESC_INITIALIZER("sweep", "", NULL, pwm_buzz_sweep_handler, "put sweep buzz"),
 };
 
 int pwm_buzz_init(void)
@@ -0,0 +1,191 @@
+/**
+ *  @file bin_bench.c
+ *
+ *  Compares the cost of one stream sample in OSC, as liblo builds and
+ *  parses it, with the binary protocol of sios_bin.h. Encoding is what
+ *  SIOS pays per sample and wire format, decoding what a client pays per
+ *  received datagram. Accmag samples are sent as in the int format with
+ *  "seq", matrix frames as in the b16 format, both carry the same
+ *  sequence number and timestamp as the binary datagram.
+ *
+ *  	binbench -n 1000000
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <lo/lo.h>
+
+#include "sios_bin.h"
+
+#define DEFAULT_ITERATIONS	1000000
+
+#define ACCMAG_PATH		"/sios/sensors/accmag/acc"
+#define MATRIX_PATH		"/sios/sensors/matrix/data"
+
+/* keeps the compiler from dropping the decoding */
+static volatile long sink;
+
+static double now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void osc_args(lo_message msg, int matrix, const void * record, uint32_t seq)
+{
+	const struct sios_shm_accmag * a = (const struct sios_shm_accmag*)record;
+	lo_timetag tt = { 3400000000U, seq };
+	lo_blob blob;
+
+	lo_message_add_int32(msg, seq);
+	lo_message_add_timetag(msg, tt);
+	if (matrix) {
+		blob = lo_blob_new(sizeof(struct sios_shm_matrix), record);
+		lo_message_add_blob(msg, blob);
+		lo_blob_free(blob);
+	} else {
+		lo_message_add_int32(msg, a->dev);
+		lo_message_add_int32(msg, a->x);
+		lo_message_add_int32(msg, a->y);
+		lo_message_add_int32(msg, a->z);
+	}
+}
+
+static void bench_osc(const char * name, int matrix, const void * record, int iterations)
+{
+	const char * path = matrix ? MATRIX_PATH : ACCMAG_PATH;
+	char buf[SIOS_BIN_MAX_PACKET];
+	double start, encode, decode;
+	lo_message msg;
+	lo_arg ** argv;
+	size_t size = 0;
+	int i, result;
+
+	start = now_nsec();
+	for (i=0;i<iterations;i++) {
+		msg = lo_message_new();
+		osc_args(msg, matrix, record, i);
+		size = sizeof(buf);
+		lo_message_serialise(msg, path, buf, &size);
+		lo_message_free(msg);
+	}
+	encode = (now_nsec() - start) / iterations;
+
+	start = now_nsec();
+	for (i=0;i<iterations;i++) {
+		msg = lo_message_deserialise(buf, size, &result);
+		argv = lo_message_get_argv(msg);
+		if (matrix)
+			sink += ((const uint16_t*)&argv[2]->blob.data)[63];
+		else
+			sink += argv[0]->i + argv[2]->i + argv[5]->i;
+		lo_message_free(msg);
+	}
+	decode = (now_nsec() - start) / iterations;
+
+	printf("%-14s %6u %10.1f %10.1f %10.2f\n", name, (unsigned int)size, encode, decode,
+	       1e3 / (encode + decode));
+}
+
+static void bench_bin(const char * name, int matrix, const void * record, int iterations)
+{
+	size_t record_size = matrix ? sizeof(struct sios_shm_matrix) : sizeof(struct sios_shm_accmag);
+	char buf[SIOS_BIN_MAX_PACKET];
+	struct sios_bin_header * hdr = (struct sios_bin_header*)buf, in;
+	struct sios_shm_matrix m;
+	struct sios_shm_accmag a;
+	double start, encode, decode;
+	const void * payload;
+	size_t size = sizeof(*hdr) + record_size;
+	int i;
+
+	/* the same steps as stream_encode() */
+	start = now_nsec();
+	for (i=0;i<iterations;i++) {
+		sios_bin_header_init(hdr, SIOS_BIN_SAMPLE, 1, record_size);
+		hdr->seq = htole32(i);
+		hdr->timestamp = htole64(1234567890123ULL + i);
+		memcpy(hdr + 1, record, record_size);
+	}
+	encode = (now_nsec() - start) / iterations;
+
+	start = now_nsec();
+	for (i=0;i<iterations;i++) {
+		if (sios_bin_decode(buf, size, &in, &payload) ||
+		    sios_bin_record(&in, payload, matrix ? (void*)&m : (void*)&a, record_size)) {
+			fprintf(stderr, "%s: decoding failed\n", name);
+			exit(1);
+		}
+		if (matrix)
+			sink += m.cells[63];
+		else
+			sink += in.seq + a.x + a.z;
+	}
+	decode = (now_nsec() - start) / iterations;
+
+	printf("%-14s %6u %10.1f %10.1f %10.2f\n", name, (unsigned int)size, encode, decode,
+	       1e3 / (encode + decode));
+}
+
+static void usage(const char * name)
+{
+	printf("usage: %s [-n iterations]\n", name);
+}
+
+int main(int argc, char * argv[])
+{
+	struct sios_shm_accmag accmag = { 0, 120, -340, 1010, 0 };
+	struct sios_shm_matrix matrix;
+	int iterations = DEFAULT_ITERATIONS;
+	int i, c;
+
+	while ((c = getopt(argc, argv, "n:h")) >= 0) {
+		switch (c) {
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (iterations <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (i=0;i<64;i++)
+		matrix.cells[i] = (i * 37) & 0x0fff;
+
+	printf("%d samples, ns per sample\n", iterations);
+	printf("%-14s %6s %10s %10s %10s\n", "format", "bytes", "encode", "decode", "M/s");
+	bench_osc("accmag osc", 0, &accmag, iterations);
+	bench_bin("accmag binary", 0, &accmag, iterations);
+	bench_osc("matrix osc", 1, &matrix, iterations);
+	bench_bin("matrix binary", 1, &matrix, iterations);
+
+	return 0;
+}
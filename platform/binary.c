@@ -0,0 +1,143 @@
+/**
+ *  @file binary.c
+ *
+ *  Requests of the binary stream protocol, see sios_bin.h. The packets
+ *  arrive through a SIOS owned receiver (receiver.c), subscriptions go
+ *  to the stream layer and commands to the OSC dispatcher.
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sios.h"
+#include "osc.h"
+#include "stream.h"
+#include "sios_bin.h"
+
+static int bin_listen(int fd, const struct sios_bin_header * hdr, const void * payload,
+		      const struct sockaddr * from, socklen_t fromlen)
+{
+	struct {
+		struct sios_bin_header hdr;
+		struct sios_bin_listen listen;
+	} reply;
+	struct sios_stream_peer peer;
+	int id;
+
+	if (hdr->length != sizeof(reply.listen))
+		return -1;
+
+	memcpy(&reply.listen, payload, sizeof(reply.listen));
+	if (!memchr(reply.listen.path, 0, SIOS_BIN_PATHSIZE) ||
+	    reply.listen.policy > SIOS_STREAM_COALESCE)
+		return -1;
+
+	peer.fd = fd;
+	memcpy(&peer.addr, from, fromlen);
+	peer.len = fromlen;
+
+	id = sios_streams_bin_listen(reply.listen.path, &peer, le32toh(reply.listen.lease),
+				     le16toh(reply.listen.queue),
+				     (enum sios_stream_policy)reply.listen.policy);
+	if (id < 0)
+		warn("OSC", "binary listen: no stream '%s'", reply.listen.path);
+
+	/* the request comes back with the id, 0 if there is no such stream */
+	sios_bin_header_init(&reply.hdr, SIOS_BIN_LISTEN, id > 0 ? id : 0, sizeof(reply.listen));
+	sendto(fd, &reply, sizeof(reply), 0, from, fromlen);
+
+	return id > 0 ? 0 : 1;
+}
+
+static int bin_silence(int fd, const struct sios_bin_header * hdr,
+		       const struct sockaddr * from, socklen_t fromlen)
+{
+	struct sios_stream_peer peer;
+
+	peer.fd = fd;
+	memcpy(&peer.addr, from, fromlen);
+	peer.len = fromlen;
+
+	sios_streams_bin_silence(hdr->stream, &peer);
+	return 0;
+}
+
+static int bin_command(const struct sios_bin_header * hdr, const void * payload)
+{
+	struct sios_bin_command cmd;
+	lo_message msg;
+	uint32_t v;
+	float f;
+	int i, handled;
+
+	if (hdr->length != sizeof(cmd))
+		return -1;
+
+	memcpy(&cmd, payload, sizeof(cmd));
+	if (cmd.path[0] != '/' || !memchr(cmd.path, 0, SIOS_BIN_PATHSIZE))
+		return -1;
+
+	msg = lo_message_new();
+	if (!msg)
+		return -1;
+
+	for (i=0;i<SIOS_BIN_MAX_ARGS && cmd.types[i];i++) {
+		memcpy(&v, &cmd.args[i], sizeof(v));
+		v = le32toh(v);
+		if (cmd.types[i] == 'i') {
+			lo_message_add_int32(msg, (int32_t)v);
+		} else if (cmd.types[i] == 'f') {
+			memcpy(&f, &v, sizeof(f));
+			lo_message_add_float(msg, f);
+		} else {
+			lo_message_free(msg);
+			return -1;
+		}
+	}
+
+	handled = sios_dispatch(cmd.path, msg);
+	lo_message_free(msg);
+
+	return handled ? 0 : 1;
+}
+
+int sios_bin_dispatch(int fd, const void * buf, size_t size,
+		      const struct sockaddr * from, socklen_t fromlen)
+{
+	struct sios_bin_header hdr;
+	const void * payload;
+
+	if (sios_bin_decode(buf, size, &hdr, &payload))
+		return -1;
+
+	switch (hdr.type) {
+		case SIOS_BIN_LISTEN:
+			return bin_listen(fd, &hdr, payload, from, fromlen);
+		case SIOS_BIN_SILENCE:
+			return bin_silence(fd, &hdr, from, fromlen);
+		case SIOS_BIN_COMMAND:
+			return bin_command(&hdr, payload);
+		default:
+			return -1;
+	}
+}
@@ -23,7 +23,7 @@ struct module_entry * module_entry;
 %}
 
 %token K_CLASS K_MODULE K_STRICT_VERSION K_USE_SYSLOG
-%token K_OSC K_OSC_PORT K_OSC_ROOT K_OSC_UDP K_OSC_TCP
+%token K_OSC K_OSC_PORT K_OSC_ROOT K_OSC_UDP K_OSC_TCP K_OSC_UDP_THREADS K_OSC_UNIX K_OSC_LEASE K_OSC_PRIORITY_PORT K_OSC_BIN_PORT
 %token K_DUMP_MODULE_XML K_XML_DUMP_PATH K_XML_MODULE_PREFIX
 %token K_LOGGER K_DUMP K_PATH K_PREFIX K_POSTFIX
 %token K_M_PATH K_M_CLASS K_M_DESC K_M_LAZY 
@@ -96,6 +96,11 @@ osc_option	: K_OSC_PORT NUMBER { config->osc.port = $2; }
 		| K_OSC_ROOT STRING { config->osc.root = strdup($2); }
 		| K_OSC_UDP BOOL { config->osc.do_udp = $2; }
 		| K_OSC_TCP BOOL { config->osc.do_tcp = $2; }
+		| K_OSC_UDP_THREADS NUMBER { config->osc.udp_threads = $2; }
+		| K_OSC_UNIX STRING { config->osc.unix_path = strdup($2); }
+		| K_OSC_LEASE NUMBER { config->osc.lease = $2; }
+		| K_OSC_PRIORITY_PORT NUMBER { config->osc.priority_port = $2; }
+		| K_OSC_BIN_PORT NUMBER { config->osc.bin_port = $2; }
 		;
 
 module		: /* empty */ { $$ = NULL; }
@@ -224,6 +229,7 @@ struct sios_config * sios_read_config(const char * path)
 	config = (struct sios_config *)malloc(sizeof(struct sios_config));
 	if (!config)
 		return NULL;
+	memset(config, 0, sizeof(struct sios_config));
 
 	INIT_LIST_HEAD(&config->class_entries);
 	INIT_LIST_HEAD(&config->module_entries);
@@ -36,6 +36,11 @@ struct kword sios_config_keywords[] = {
 	{"osc_root",		K_OSC_ROOT		},
 	{"osc_udp",		K_OSC_UDP		},
 	{"osc_tcp",		K_OSC_TCP		},
+	{"osc_udp_threads",	K_OSC_UDP_THREADS	},
+	{"osc_unix",		K_OSC_UNIX		},
+	{"osc_lease",		K_OSC_LEASE		},
+	{"osc_priority_port",	K_OSC_PRIORITY_PORT	},
+	{"osc_bin_port",	K_OSC_BIN_PORT		},
 
 	{"logger",		K_LOGGER		},
 	{"dump",		K_DUMP			},
@@ -0,0 +1,169 @@
+/**
+ *  @file dispatch.c
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sios.h"
+#include "osc.h"
+#include "jhash.h"
+
+/* must be a power of two */
+#define DISPATCH_HASH_SIZE	256
+#define DISPATCH_HASH_MASK	(DISPATCH_HASH_SIZE - 1)
+
+/* characters that make an incoming address an OSC pattern */
+#define OSC_PATTERN_CHARS	"*?[]{}"
+
+/**
+ * Method table shared by all SIOS owned OSC receivers.
+ *
+ * Entries are hashed on their full path so exact addresses resolve with a
+ * single bucket lookup, only wildcard addresses walk the complete list.
+ * Entries are added at registration time and looked up by every receiver
+ * thread, hence the read/write lock.
+ */
+struct dispatch_entry {
+	char path[SIOS_MAX_PATHSIZE];		/**< Full OSC address of the method */
+	uint32_t hash;				/**< hashlittle() of path */
+	struct sios_method_desc * desc;		/**< The method called on a match */
+	struct list_head entry;			/**< list_head entry for dispatch_list */
+	struct list_head hentry;		/**< list_head entry for the hash bucket */
+};
+
+static LIST_HEAD(dispatch_list);
+static struct list_head dispatch_hash[DISPATCH_HASH_SIZE];
+static pthread_rwlock_t dispatch_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_once_t dispatch_once = PTHREAD_ONCE_INIT;
+
+static void dispatch_hash_init(void)
+{
+	int i;
+
+	for (i=0;i<DISPATCH_HASH_SIZE;i++)
+		INIT_LIST_HEAD(&dispatch_hash[i]);
+}
+
+static inline uint32_t dispatch_hash_path(const char * path)
+{
+	return hashlittle(path, strlen(path), 0);
+}
+
+int sios_dispatch_add(const char * path, struct sios_method_desc * desc)
+{
+	struct dispatch_entry * e;
+
+	if (!path || !desc || !desc->handler)
+		return -1;
+
+	pthread_once(&dispatch_once, dispatch_hash_init);
+
+	e = (struct dispatch_entry*)malloc(sizeof(struct dispatch_entry));
+	if (!e) {
+		err("OSC", "out of memory while adding dispatch entry");
+		return -1;
+	}
+
+	snprintf(e->path, SIOS_MAX_PATHSIZE, "%s", path);
+	e->hash = dispatch_hash_path(e->path);
+	e->desc = desc;
+	INIT_LIST_HEAD(&e->entry);
+	INIT_LIST_HEAD(&e->hentry);
+
+	pthread_rwlock_wrlock(&dispatch_lock);
+	list_add_tail(&e->entry, &dispatch_list);
+	list_add_tail(&e->hentry, &dispatch_hash[e->hash & DISPATCH_HASH_MASK]);
+	pthread_rwlock_unlock(&dispatch_lock);
+
+	return 0;
+}
+
+void sios_dispatch_del(struct sios_method_desc * desc)
+{
+	struct dispatch_entry * e, * tmp;
+
+	pthread_rwlock_wrlock(&dispatch_lock);
+	list_for_each_entry_safe(e, tmp, &dispatch_list, entry) {
+		if (e->desc == desc) {
+			list_del(&e->entry);
+			list_del(&e->hentry);
+			free(e);
+		}
+	}
+	pthread_rwlock_unlock(&dispatch_lock);
+}
+
+static inline int dispatch_call(struct dispatch_entry * e, const char * path,
+				const char * types, lo_message msg, unsigned int flags)
+{
+	struct sios_method_desc * desc = e->desc;
+
+	if ((desc->flags & flags) != flags)
+		return 0;
+
+	/* like liblo, a NULL typespec accepts any arguments */
+	if (desc->typespec && strcmp(desc->typespec, types))
+		return 0;
+
+	desc->handler(path, types, lo_message_get_argv(msg),
+		      lo_message_get_argc(msg), msg, desc);
+	return 1;
+}
+
+int sios_dispatch(const char * path, lo_message msg)
+{
+	return sios_dispatch_flags(path, msg, 0);
+}
+
+int sios_dispatch_flags(const char * path, lo_message msg, unsigned int flags)
+{
+	struct dispatch_entry * e;
+	const char * types;
+	uint32_t hash;
+	int matched = 0;
+
+	if (!path || !msg)
+		return 0;
+
+	types = lo_message_get_types(msg);
+	if (!types)
+		types = "";
+
+	pthread_once(&dispatch_once, dispatch_hash_init);
+
+	pthread_rwlock_rdlock(&dispatch_lock);
+	if (strpbrk(path, OSC_PATTERN_CHARS)) {
+		list_for_each_entry(e, &dispatch_list, entry) {
+			if (lo_pattern_match(e->path, path))
+				matched += dispatch_call(e, path, types, msg, flags);
+		}
+	} else {
+		hash = dispatch_hash_path(path);
+		list_for_each_entry(e, &dispatch_hash[hash & DISPATCH_HASH_MASK], hentry) {
+			if (e->hash == hash && !strcmp(e->path, path))
+				matched += dispatch_call(e, path, types, msg, flags);
+		}
+	}
+	pthread_rwlock_unlock(&dispatch_lock);
+
+	return matched;
+}
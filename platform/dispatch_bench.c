@@ -0,0 +1,187 @@
+/**
+ *  @file dispatch_bench.c
+ *
+ *  Measures the cost of dispatching one OSC message against the number
+ *  of registered methods, for liblo's method list and for the SIOS
+ *  hashed method table (see dispatch.c).
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "timediff.h"
+#include "sios.h"
+#include "osc.h"
+
+#define DEFAULT_ITERATIONS	100000
+
+char use_syslog = 0;
+
+static unsigned long calls;
+
+static int count_handler(const char *path, const char *types, lo_arg **argv,
+			 int argc, lo_message msg, void *user_data)
+{
+	calls++;
+	return 0;
+}
+
+static void method_path(char * buf, int i)
+{
+	/* same shape as the paths SIOS objects register */
+	snprintf(buf, SIOS_MAX_PATHSIZE, "/sios/object%d/method%d", i / 8, i % 8);
+}
+
+static double elapsed_usec(struct timeval * start)
+{
+	struct timeval stop, dT;
+
+	gettimeofday(&stop, NULL);
+	timeval_subtract(&dT, &stop, start);
+	return (double)timeval_to_usec(&dT);
+}
+
+static double bench_liblo(int methods, int iterations, const char * path)
+{
+	struct timeval start;
+	char mpath[SIOS_MAX_PATHSIZE];
+	lo_server s;
+	lo_message msg;
+	void * data;
+	size_t size;
+	double usec;
+	int i;
+
+	s = lo_server_new_with_proto(NULL, LO_UDP, NULL);
+	if (!s)
+		return -1.0;
+
+	for (i=0;i<methods;i++) {
+		method_path(mpath, i);
+		lo_server_add_method(s, mpath, "i", count_handler, NULL);
+	}
+
+	msg = lo_message_new();
+	lo_message_add_int32(msg, 1);
+	data = lo_message_serialise(msg, path, NULL, &size);
+
+	gettimeofday(&start, NULL);
+	for (i=0;i<iterations;i++)
+		lo_server_dispatch_data(s, data, size);
+	usec = elapsed_usec(&start);
+
+	free(data);
+	lo_message_free(msg);
+	lo_server_free(s);
+
+	return usec * 1000.0 / iterations;
+}
+
+static double bench_sios(int methods, int iterations, const char * path)
+{
+	struct timeval start;
+	struct sios_method_desc * descs;
+	char mpath[SIOS_MAX_PATHSIZE];
+	lo_message msg, in;
+	void * data;
+	size_t size;
+	double usec;
+	int i, result;
+
+	descs = (struct sios_method_desc*)calloc(methods, sizeof(struct sios_method_desc));
+	if (!descs)
+		return -1.0;
+
+	for (i=0;i<methods;i++) {
+		method_path(mpath, i);
+		descs[i].typespec = "i";
+		descs[i].handler = count_handler;
+		sios_dispatch_add(mpath, &descs[i]);
+	}
+
+	msg = lo_message_new();
+	lo_message_add_int32(msg, 1);
+	data = lo_message_serialise(msg, path, NULL, &size);
+
+	/* deserialise every time, as the receivers do */
+	gettimeofday(&start, NULL);
+	for (i=0;i<iterations;i++) {
+		in = lo_message_deserialise(data, size, &result);
+		sios_dispatch(data, in);
+		lo_message_free(in);
+	}
+	usec = elapsed_usec(&start);
+
+	for (i=0;i<methods;i++)
+		sios_dispatch_del(&descs[i]);
+
+	free(data);
+	lo_message_free(msg);
+	free(descs);
+
+	return usec * 1000.0 / iterations;
+}
+
+static void usage(const char * name)
+{
+	printf("usage: %s [-n iterations]\n", name);
+}
+
+int main(int argc, char * argv[])
+{
+	static const int counts[] = { 8, 32, 128, 512, 2048 };
+	char exact[SIOS_MAX_PATHSIZE];
+	int iterations = DEFAULT_ITERATIONS;
+	int i, c;
+
+	while ((c = getopt(argc, argv, "n:h")) >= 0) {
+		switch (c) {
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (iterations <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	printf("%d iterations, ns per message\n", iterations);
+	printf("%8s %12s %12s %12s %12s\n", "methods",
+	       "liblo", "sios", "liblo (*)", "sios (*)");
+
+	for (i=0;i<sizeof(counts)/sizeof(counts[0]);i++) {
+		/* the last method registered is the worst case for a list */
+		method_path(exact, counts[i] - 1);
+		printf("%8d %12.1f %12.1f %12.1f %12.1f\n", counts[i],
+		       bench_liblo(counts[i], iterations, exact),
+		       bench_sios(counts[i], iterations, exact),
+		       bench_liblo(counts[i], iterations, "/sios/object0/*"),
+		       bench_sios(counts[i], iterations, "/sios/object0/*"));
+	}
+	printf("handler calls: %lu\n", calls);
+
+	return 0;
+}
@@ -96,4 +96,103 @@ typedef unsigned int mm_fixed64lo_t;
 #define fsub(x, y)	    sub((x), (y))
 #define fdivff(x1, x2)	    (int)((((long long)(x1) << 32) / (x2)) >> 16)
 
+#define MM_FIXED_PI	    ((mm_fixed_t) 205887)	/* pi in radians */
+#define MM_FIXED_HALF_PI    ((mm_fixed_t) 102944)
+#define MM_FIXED_CORDIC_K   ((mm_fixed_t) 39797)	/* 1 / CORDIC gain */
+#define MM_FIXED_CORDIC_N   16
+
+/* atan(2^-i), 16.16 radians */
+static inline mm_fixed_t fcordic_angle(int i)
+{
+	static const mm_fixed_t angles[MM_FIXED_CORDIC_N] = {
+		51472, 30386, 16055, 8150, 4091, 2047, 1024, 512,
+		256, 128, 64, 32, 16, 8, 4, 2,
+	};
+	return angles[i];
+}
+
+/*
+ * atan2 by CORDIC vectoring. y and x are integers of any common scale,
+ * returns 16.16 radians in [-pi, pi].
+ */
+static inline mm_fixed_t fatan2(int y, int x)
+{
+	mm_fixed_t angle = 0;
+	int i, t;
+
+	if (!x && !y)
+		return 0;
+
+	/* into the right half plane, where CORDIC converges */
+	if (x < 0) {
+		angle = y >= 0 ? MM_FIXED_PI : -MM_FIXED_PI;
+		x = -x;
+		y = -y;
+	}
+
+	/* as many significant bits as the gain of 1.65 leaves room for */
+	while (x >= (1 << 28) || y >= (1 << 28) || y <= -(1 << 28)) {
+		x /= 2;
+		y /= 2;
+	}
+	while (x < (1 << 27) && y < (1 << 27) && y > -(1 << 27)) {
+		x *= 2;
+		y *= 2;
+	}
+
+	for (i=0;i<MM_FIXED_CORDIC_N;i++) {
+		if (y > 0) {
+			t = x + (y >> i);
+			y -= x >> i;
+			angle += fcordic_angle(i);
+		} else {
+			t = x - (y >> i);
+			y += x >> i;
+			angle -= fcordic_angle(i);
+		}
+		x = t;
+	}
+
+	return angle;
+}
+
+/*
+ * Sine and cosine of 16.16 radians by CORDIC rotation, both 16.16.
+ */
+static inline void fsincos(mm_fixed_t a, mm_fixed_t * s, mm_fixed_t * c)
+{
+	mm_fixed_t x = MM_FIXED_CORDIC_K, y = 0, t;
+	int i, neg = 0;
+
+	while (a > MM_FIXED_PI)
+		a -= 2 * MM_FIXED_PI;
+	while (a < -MM_FIXED_PI)
+		a += 2 * MM_FIXED_PI;
+
+	/* CORDIC covers +-pi/2, the rest is a half turn away */
+	if (a > MM_FIXED_HALF_PI) {
+		a -= MM_FIXED_PI;
+		neg = 1;
+	} else if (a < -MM_FIXED_HALF_PI) {
+		a += MM_FIXED_PI;
+		neg = 1;
+	}
+
+	for (i=0;i<MM_FIXED_CORDIC_N;i++) {
+		if (a >= 0) {
+			t = x - (y >> i);
+			y += x >> i;
+			a -= fcordic_angle(i);
+		} else {
+			t = x + (y >> i);
+			y -= x >> i;
+			a += fcordic_angle(i);
+		}
+		x = t;
+	}
+
+	*s = neg ? -y : y;
+	*c = neg ? -x : x;
+}
+
 #endif
@@ -0,0 +1,146 @@
+/**
+ *  @file frame.c
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <string.h>
+
+#include "frame.h"
+
+int sios_frame_pack16(unsigned char * out, const uint16_t * values, int n)
+{
+	int i, len = 0;
+
+	for (i=0;i<n;i++) {
+		out[len++] = values[i] >> 8;
+		out[len++] = values[i] & 0xff;
+	}
+	return len;
+}
+
+int sios_frame_pack12(unsigned char * out, const uint16_t * values, int n)
+{
+	int i, len = 0;
+
+	for (i=0;i+1<n;i+=2) {
+		out[len++] = (values[i] >> 4) & 0xff;
+		out[len++] = ((values[i] & 0x0f) << 4) | ((values[i+1] >> 8) & 0x0f);
+		out[len++] = values[i+1] & 0xff;
+	}
+	if (i < n) {
+		out[len++] = (values[i] >> 8) & 0x0f;
+		out[len++] = values[i] & 0xff;
+	}
+	return len;
+}
+
+int sios_frame_unpack16(uint16_t * values, int n, const unsigned char * in, int len)
+{
+	int i;
+
+	if (len != SIOS_FRAME_B16_SIZE(n))
+		return -1;
+
+	for (i=0;i<n;i++)
+		values[i] = (in[2*i] << 8) | in[2*i+1];
+	return 0;
+}
+
+int sios_frame_unpack12(uint16_t * values, int n, const unsigned char * in, int len)
+{
+	int i;
+
+	if (len != SIOS_FRAME_B12_SIZE(n))
+		return -1;
+
+	for (i=0;i+1<n;i+=2, in+=3) {
+		values[i] = (in[0] << 4) | (in[1] >> 4);
+		values[i+1] = ((in[1] & 0x0f) << 8) | in[2];
+	}
+	if (i < n)
+		values[i] = ((in[0] & 0x0f) << 8) | in[1];
+	return 0;
+}
+
+void sios_frame_delta_init(struct sios_frame_delta * d, int n, unsigned int interval,
+			   unsigned int threshold)
+{
+	memset(d, 0, sizeof(*d));
+	d->n = n > SIOS_FRAME_MAX ? SIOS_FRAME_MAX : n;
+	d->interval = interval;
+	d->threshold = threshold;
+}
+
+int sios_frame_delta_encode(struct sios_frame_delta * d, unsigned char * out,
+			    const uint16_t * values, uint32_t frame, uint32_t * key_frame)
+{
+	int i, len = 0, diff;
+	int max = SIOS_FRAME_B12_SIZE(d->n);
+
+	if (d->have_key && !d->force &&
+	    (!d->interval || frame - d->key_frame < d->interval)) {
+		for (i=0;i<d->n;i++) {
+			diff = (int)values[i] - (int)d->key[i];
+			if (diff <= (int)d->threshold && diff >= -(int)d->threshold)
+				continue;
+			if (len + SIOS_FRAME_DELTA_ENTRY > max)
+				break;
+			out[len++] = i;
+			out[len++] = values[i] >> 8;
+			out[len++] = values[i] & 0xff;
+		}
+
+		/* a keyframe is no bigger and refreshes the reference */
+		if (i == d->n && len < max) {
+			*key_frame = d->key_frame;
+			return len;
+		}
+	}
+
+	memcpy(d->key, values, d->n * sizeof(uint16_t));
+	d->key_frame = frame;
+	d->have_key = 1;
+	d->force = 0;
+
+	*key_frame = frame;
+	return sios_frame_pack12(out, values, d->n);
+}
+
+int sios_frame_delta_decode(uint16_t * values, uint16_t * key, int n, int keyframe,
+			    const unsigned char * in, int len)
+{
+	int i;
+
+	if (keyframe) {
+		if (sios_frame_unpack12(key, n, in, len))
+			return -1;
+		memcpy(values, key, n * sizeof(uint16_t));
+		return 0;
+	}
+
+	if (len % SIOS_FRAME_DELTA_ENTRY)
+		return -1;
+
+	memcpy(values, key, n * sizeof(uint16_t));
+	for (i=0;i<len;i+=SIOS_FRAME_DELTA_ENTRY) {
+		if (in[i] >= n)
+			return -1;
+		values[in[i]] = (in[i+1] << 8) | in[i+2];
+	}
+	return 0;
+}
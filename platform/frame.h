@@ -0,0 +1,98 @@
+/**
+ *  @file frame.h
+ *
+ *  Compact encodings of frames of 12 bit sensor values, as sent in the
+ *  blobs of the b12, b16 and delta stream formats. The encoders do not
+ *  depend on liblo or the rest of SIOS, clients can use the decoders as
+ *  is.
+ *
+ *  All multi byte values are big endian.
+ *
+ *  b16:   2 bytes per value.
+ *  b12:   2 values in 3 bytes, aaaaaaaa aaaabbbb bbbbbbbb. An odd last
+ *         value takes 2 bytes.
+ *  delta: a keyframe is a b12 frame. Any other frame lists the values
+ *         that differ from the last keyframe as 3 byte entries: the
+ *         value's index followed by the value in 16 bits. Deltas never
+ *         refer to each other, a lost message costs that frame only.
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+
+/* values per frame, indices must fit a byte */
+#define SIOS_FRAME_MAX		256
+
+#define SIOS_FRAME_B12_SIZE(_n)		((_n) / 2 * 3 + ((_n) & 1) * 2)
+#define SIOS_FRAME_B16_SIZE(_n)		((_n) * 2)
+#define SIOS_FRAME_DELTA_ENTRY		3
+
+/**
+ * Encoder state of a delta encoded frame sequence.
+ */
+struct sios_frame_delta {
+	int n;				/**< Values per frame */
+	unsigned int interval;		/**< Frames between keyframes, 0 for never */
+	unsigned int threshold;		/**< Differences up to this are not sent */
+	int force;			/**< Make the next frame a keyframe */
+	int have_key;			/**< key holds a keyframe */
+	uint32_t key_frame;		/**< Frame number of the last keyframe */
+	uint16_t key[SIOS_FRAME_MAX];	/**< Values of the last keyframe */
+};
+
+int sios_frame_pack16(unsigned char * out, const uint16_t * values, int n);
+int sios_frame_pack12(unsigned char * out, const uint16_t * values, int n);
+int sios_frame_unpack16(uint16_t * values, int n, const unsigned char * in, int len);
+int sios_frame_unpack12(uint16_t * values, int n, const unsigned char * in, int len);
+
+/**
+ * Initialize a delta encoder for frames of n values.
+ */
+void sios_frame_delta_init(struct sios_frame_delta * d, int n, unsigned int interval,
+			   unsigned int threshold);
+
+/**
+ * Delta encode a frame.
+ *
+ * Sends a keyframe when one is due, was forced, or would not be larger
+ * than the delta.
+ *
+ * @param out Room for SIOS_FRAME_B12_SIZE(n) bytes
+ * @param frame Number of the frame
+ * @param key_frame Set to the number of the keyframe the result refers
+ * to, equal to frame for a keyframe
+ * @return Number of bytes written to out
+ */
+int sios_frame_delta_encode(struct sios_frame_delta * d, unsigned char * out,
+			    const uint16_t * values, uint32_t frame, uint32_t * key_frame);
+
+/**
+ * Decode a delta format blob into values.
+ *
+ * key holds the values of the keyframe, it is updated when blob is a
+ * keyframe.
+ *
+ * @return 0 on success, -1 for a malformed blob
+ */
+int sios_frame_delta_decode(uint16_t * values, uint16_t * key, int n, int keyframe,
+			    const unsigned char * in, int len);
+
+#endif /* FRAME_H */
@@ -0,0 +1,170 @@
+/**
+ *  @file frame_bench.c
+ *
+ *  Reports the bandwidth of the matrix stream formats for a recorded
+ *  session, and checks that the delta format decodes to the original
+ *  frames. Record a session on the board with
+ *
+ *  	dd if=/dev/sios_matrix of=session.raw bs=128 count=6000
+ *
+ *  and run framebench -f session.raw [-i keyframe_interval] [-t threshold].
+ *  Without -f a synthetic session is generated: sensor noise on a flat
+ *  baseline with a pressure spot that wanders over the matrix part of
+ *  the time. Sizes are OSC payload bytes, add 28 bytes of UDP/IP header
+ *  per message for the wire.
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "frame.h"
+
+#define CELLS		64
+#define RAW_FRAME	(CELLS * 2)
+#define PATH		"/sios/sensors/matrix/data"
+
+#define OSC_PAD(_n)	(((_n) + 3) & ~3)
+#define OSC_STRING(_s)	OSC_PAD(strlen(_s) + 1)
+
+static int synthetic_frame(int n, uint16_t * cells)
+{
+	static unsigned int seed = 1;
+	int i, x, y, cx, cy, d;
+
+	/* 60 s at 100 Hz, a spot is pressed during 20 s of it */
+	if (n >= 6000)
+		return 0;
+
+	cx = (n / 40) % 8;
+	cy = (n / 70) % 8;
+	for (i=0;i<CELLS;i++) {
+		x = i % 8;
+		y = i / 8;
+		cells[i] = 200 + rand_r(&seed) % 3;
+		if (n >= 2000 && n < 4000) {
+			d = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+			if (d < 4)
+				cells[i] += 3000 / (d + 1) + rand_r(&seed) % 16;
+		}
+	}
+	return 1;
+}
+
+static int recorded_frame(FILE * f, uint16_t * cells)
+{
+	unsigned char raw[RAW_FRAME];
+	int i;
+
+	if (fread(raw, RAW_FRAME, 1, f) != 1)
+		return 0;
+
+	/* as read by the matrix module */
+	for (i=0;i<RAW_FRAME;i+=2)
+		cells[i/2] = ((raw[i] << 8) | raw[i+1]) & 0x0fff;
+	return 1;
+}
+
+static void usage(const char * name)
+{
+	printf("usage: %s [-f session.raw] [-i keyframe_interval] [-t threshold]\n", name);
+}
+
+int main(int argc, char * argv[])
+{
+	struct sios_frame_delta d;
+	unsigned char blob[SIOS_FRAME_B16_SIZE(CELLS)];
+	uint16_t cells[CELLS], decoded[CELLS], key[CELLS];
+	unsigned long frames = 0, keyframes = 0, mismatches = 0;
+	unsigned long b_int = 0, b_12 = 0, b_16 = 0, b_delta = 0;
+	unsigned int interval = 100, threshold = 0;
+	const char * file = NULL;
+	uint32_t key_frame;
+	FILE * f = NULL;
+	int c, len, path;
+
+	while ((c = getopt(argc, argv, "f:i:t:h")) >= 0) {
+		switch (c) {
+			case 'f':
+				file = optarg;
+				break;
+			case 'i':
+				interval = atoi(optarg);
+				break;
+			case 't':
+				threshold = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (file) {
+		f = fopen(file, "rb");
+		if (!f) {
+			perror(file);
+			return 1;
+		}
+	}
+
+	sios_frame_delta_init(&d, CELLS, interval, threshold);
+	path = OSC_STRING(PATH);
+
+	while (f ? recorded_frame(f, cells) : synthetic_frame(frames, cells)) {
+		/* path, typetag, arguments */
+		b_int += path + OSC_PAD(1 + CELLS + 1) + CELLS * 4;
+		b_12 += path + OSC_STRING(",itb") + 4 + 8 + 4 + OSC_PAD(SIOS_FRAME_B12_SIZE(CELLS));
+		b_16 += path + OSC_STRING(",itb") + 4 + 8 + 4 + OSC_PAD(SIOS_FRAME_B16_SIZE(CELLS));
+
+		len = sios_frame_delta_encode(&d, blob, cells, frames, &key_frame);
+		b_delta += path + OSC_STRING(",iitb") + 4 + 4 + 8 + 4 + OSC_PAD(len);
+		if (key_frame == frames)
+			keyframes++;
+
+		if (sios_frame_delta_decode(decoded, key, CELLS, key_frame == frames, blob, len) ||
+		    (!threshold && memcmp(decoded, cells, sizeof(cells))))
+			mismatches++;
+
+		frames++;
+	}
+
+	if (f)
+		fclose(f);
+
+	if (!frames) {
+		printf("no frames\n");
+		return 1;
+	}
+
+	printf("%lu %s frames, keyframe interval %u, threshold %u\n", frames,
+	       file ? "recorded" : "synthetic", interval, threshold);
+	printf("%-8s %12s %10s %8s\n", "format", "bytes", "per frame", "of int");
+	printf("%-8s %12lu %10.1f %7.1f%%\n", "int", b_int, (double)b_int / frames, 100.0);
+	printf("%-8s %12lu %10.1f %7.1f%%\n", "b16", b_16, (double)b_16 / frames, 100.0 * b_16 / b_int);
+	printf("%-8s %12lu %10.1f %7.1f%%\n", "b12", b_12, (double)b_12 / frames, 100.0 * b_12 / b_int);
+	printf("%-8s %12lu %10.1f %7.1f%%\n", "delta", b_delta, (double)b_delta / frames,
+	       100.0 * b_delta / b_int);
+	printf("%lu keyframes, %lu frames did not decode%s\n", keyframes, mismatches,
+	       threshold ? " (not checked with a threshold)" : "");
+
+	return mismatches ? 1 : 0;
+}
@@ -0,0 +1,18 @@
+/**
+ *  @file jhash.h
+ *
+ *  Prototypes for the lookup3 hash functions in jhash.c
+ *  (Bob Jenkins, May 2006, Public Domain).
+ */
+
+#ifndef JHASH_H
+#define JHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t hashword(const uint32_t *k, size_t length, uint32_t initval);
+uint32_t hashlittle(const void *key, size_t length, uint32_t initval);
+uint32_t hashbig(const void *key, size_t length, uint32_t initval);
+
+#endif /* JHASH_H */
@@ -31,11 +31,13 @@
 #include "version.h"
 
 #include "osc.h"
+#include "stream.h"
 #include "xmldump.h"
 
 #define DEFAULT_CONFIGURE_PATH	"/etc/sios.config"
 
 static volatile short halt = 0;
+static volatile short print_stats = 0;
 
 static void handle_sigint(int sigraised)
 {
@@ -44,6 +46,11 @@ static void handle_sigint(int sigraised)
 	halt = 1;
 }
 
+static void handle_sigusr1(int sigraised)
+{
+	print_stats = 1;
+}
+
 static void usage(const char * name) {
 	printf("Usage: sios [OPTIONS]\n\n");
 	printf("  -p, --osc_port\t\t\tOSC server port\n");
@@ -68,6 +75,7 @@ int main(int argc, char * argv[])
 
 	signal(SIGINT, handle_sigint);
 	signal(SIGQUIT, handle_sigint);
+	signal(SIGUSR1, handle_sigusr1);
 
 	while(1) {
 		static int c;
@@ -122,8 +130,14 @@ int main(int argc, char * argv[])
 	if (config->dump_module_xml) 
 		sios_dump_xml();
 
-	while (!halt) 
+	while (!halt) {
 		sleep(1);
+		sios_streams_reap();
+		if (print_stats) {
+			print_stats = 0;
+			sios_osc_print_stats();
+		}
+	}
 	
 	main_cleanup();
 
@@ -85,6 +85,22 @@ extern struct sios_class * __this_class;
 		.desc = _d,			\
 	}
 
+/**
+ * Declare a method descriptor of an actuator command.
+ *
+ * Actuator methods are also served on the OSC priority port.
+ */
+#define ACTUATOR_DESC_INITIALIZER(_n,_m,_t,_h,_d)	\
+	{					\
+		.obj = THIS_MODULE,		\
+		.name = _n,			\
+		.m_addr = _m,			\
+		.typespec = _t,			\
+		.handler = _h,			\
+		.desc = _d,			\
+		.flags = SIOS_METHOD_ACTUATOR,	\
+	}
+
 /**
  * Declare a parameter descriptor.
  */
@@ -18,12 +18,19 @@
  *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+#include <sys/select.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include "sios.h"
 #include "osc.h"
+#include "stream.h"
+
+/* liblo keeps accepted tcp connections to itself, so the tcp thread can
+ * not select on them and wakes up this often to check for shutdown (ms) */
+#define OSC_TCP_WAIT	1000
 
 static pthread_t udp_osc_thread;
 static pthread_t tcp_osc_thread;
@@ -33,28 +40,106 @@ static lo_server tcp_server = NULL;
 
 static volatile int halt = 0;
 static pthread_mutex_t halt_lock = PTHREAD_MUTEX_INITIALIZER;
+static int wakeup_pipe[2] = { -1, -1 };
+
+/* writer transactions of bundles liblo is dispatching in this thread */
+static __thread int bundle_depth = 0;
 
 static void err_handler(int num, const char *msg, const char *where)
 {
 	err("OSC", "%d, %s: %s", num, where, msg);
 }
 
+/* 
+ * Blocks until fd becomes readable, the timeout expires or 
+ * sios_osc_terminate() writes to the wakeup pipe. A negative timeout
+ * blocks forever. Returns >0 if fd is readable, 0 on timeout and <0 
+ * when woken up for shutdown.
+ */
+int sios_osc_wait(int fd, double timeout)
+{
+	fd_set read_set;
+	struct timeval wait, * waitp = NULL;
+	int n, max_fd;
+
+	if (timeout >= 0) {
+		wait.tv_sec = (time_t)timeout;
+		wait.tv_usec = (suseconds_t)((timeout - wait.tv_sec) * 1000000);
+		waitp = &wait;
+	}
+
+	FD_ZERO(&read_set);
+	FD_SET(fd, &read_set);
+	FD_SET(wakeup_pipe[0], &read_set);
+	max_fd = (fd > wakeup_pipe[0]) ? fd : wakeup_pipe[0];
+
+	n = select(max_fd + 1, &read_set, NULL, NULL, waitp);
+	if (n < 0) 
+		return (errno == EINTR) ? 0 : -1;
+	if (FD_ISSET(wakeup_pipe[0], &read_set))
+		return -1;
+	return n;
+}
+
+/* liblo skips the end handler of a bundle it gives up on halfway */
+static void close_bundles(void)
+{
+	while (bundle_depth > 0) {
+		bundle_depth--;
+		sios_sources_commit();
+	}
+}
+
 static void * udp_thread(void * arg)
 {
+	int fd = lo_server_get_socket_fd(udp_server);
+
 	info("OSC", "udp port %d", lo_server_get_port(udp_server));
-	while(!halt)
-		lo_server_recv_noblock(udp_server, 10);
+	while (!halt) {
+		/* sleep until a packet arrives or a queued bundle is due */
+		if (sios_osc_wait(fd, lo_server_next_event_delay(udp_server)) < 0)
+			break;
+		lo_server_recv_noblock(udp_server, 0);
+		close_bundles();
+	}
 	return NULL;
 }
 
 static void * tcp_thread(void * arg)
 {
-	info("OSC", "tcp port %d", lo_server_get_port(udp_server));
-	while(!halt)
-		lo_server_recv_noblock(tcp_server, 10);
+	info("OSC", "tcp port %d", lo_server_get_port(tcp_server));
+	while (!halt) {
+		lo_server_recv_noblock(tcp_server, OSC_TCP_WAIT);
+		close_bundles();
+	}
 	return NULL;
 }
 
+/* liblo only sees this catch-all method, lookups go through the SIOS table */
+static int dispatch_handler(const char *path, const char *types, lo_arg **argv, 
+			    int argc, lo_message msg, void *user_data)
+{
+	return sios_dispatch(path, msg) ? 0 : 1;
+}
+
+/* liblo hands a bundle to dispatch_handler message by message, keep them
+ * in one writer transaction like the SIOS receivers do */
+static int bundle_start_handler(lo_timetag time, void *user_data)
+{
+	sios_sources_begin();
+	bundle_depth++;
+	return 0;
+}
+
+static int bundle_end_handler(void *user_data)
+{
+	if (bundle_depth > 0) {
+		bundle_depth--;
+		sios_sources_commit();
+	}
+	return 0;
+}
+
 int sios_osc_init(struct osc_entry * osc) 
 {
 	int retval;
@@ -64,12 +149,37 @@ int sios_osc_init(struct osc_entry * osc)
 	snprintf(sport, 8, "%d", osc->port);
 
 	dbg("osc port: %s", sport);
-	if (osc->do_udp) {
+
+	if (pipe(wakeup_pipe)) {
+		err("OSC", "failed creating wakeup pipe: %s", strerror(errno));
+		return -1;
+	}
+	fcntl(wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+
+	sios_streams_set_lease(osc->lease);
+
+	/* liblo schedules bundles itself, our receivers need a scheduler */
+	if ((osc->do_udp && osc->udp_threads > 0) || osc->unix_path || osc->priority_port > 0) {
+		retval = sios_osc_sched_init();
+		if (retval)
+			return retval;
+	}
+
+	if (osc->do_udp && osc->udp_threads > 0) {
+		retval = sios_osc_receivers_init(osc->port, osc->udp_threads);
+		if (retval) {
+			fatal("OSC", 10, "Failed starting udp receivers on port '%d'", osc->port);
+			return -1;
+		}
+	} else if (osc->do_udp) {
 		udp_server = lo_server_new_with_proto(sport, LO_UDP, err_handler);
 		if (!udp_server) {
 			fatal("OSC", 10, "Failed binding udp port '%d'", osc->port);
 			return -1;
 		}
+		lo_server_add_method(udp_server, NULL, NULL, dispatch_handler, NULL);
+		lo_server_add_bundle_handlers(udp_server, bundle_start_handler,
+					      bundle_end_handler, NULL);
 
 		retval = pthread_create(&udp_osc_thread, NULL, udp_thread, NULL);
 		if (retval) {
@@ -78,12 +188,39 @@ int sios_osc_init(struct osc_entry * osc)
 		}
 	}
 
+	if (osc->priority_port > 0) {
+		retval = sios_osc_priority_init(osc->priority_port);
+		if (retval) {
+			fatal("OSC", 10, "Failed binding priority port '%d'", osc->priority_port);
+			return -1;
+		}
+	}
+
+	if (osc->bin_port > 0) {
+		retval = sios_osc_bin_init(osc->bin_port);
+		if (retval) {
+			fatal("OSC", 10, "Failed binding binary protocol port '%d'", osc->bin_port);
+			return -1;
+		}
+	}
+
+	if (osc->unix_path) {
+		retval = sios_osc_unix_init(osc->unix_path);
+		if (retval) {
+			fatal("OSC", 10, "Failed binding unix socket '%s'", osc->unix_path);
+			return -1;
+		}
+	}
+
 	if (osc->do_tcp) {
 		tcp_server = lo_server_new_with_proto(sport, LO_TCP, err_handler);
 		if (!tcp_server) {
 			fatal("OSC", 10, "Failed binding tcp port '%d'", osc->port);
 			return -1;
 		}
+		lo_server_add_method(tcp_server, NULL, NULL, dispatch_handler, NULL);
+		lo_server_add_bundle_handlers(tcp_server, bundle_start_handler,
+					      bundle_end_handler, NULL);
 
 		retval = pthread_create(&tcp_osc_thread, NULL, tcp_thread, NULL);
 		if (retval) {
@@ -96,9 +233,51 @@ int sios_osc_init(struct osc_entry * osc)
 }
 
 void sios_osc_terminate() {
+	char c = 0;
+
 	pthread_mutex_lock(&halt_lock);
 	halt = 1;
 	pthread_mutex_unlock(&halt_lock);
+
+	/* a full pipe already has a wakeup pending */
+	if (wakeup_pipe[1] >= 0 && write(wakeup_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+		err("OSC", "failed waking up receivers: %s", strerror(errno));
+
+	if (udp_server) {
+		dbg("joining udp osc thread");
+		pthread_join(udp_osc_thread, NULL);
+	}
+
+	if (tcp_server) {
+		dbg("joining tcp osc thread");
+		pthread_join(tcp_osc_thread, NULL);
+	}
+
+	sios_osc_print_stats();
+	sios_streams_exit();
+	sios_osc_receivers_exit();
+	sios_osc_sched_exit();
+}
+
+void sios_osc_print_stats(void)
+{
+	sios_osc_receivers_print_stats();
+	sios_osc_sched_print_stats();
+	sios_streams_print_stats();
+}
+
+int sios_osc_address_equal(lo_address a, lo_address b)
+{
+	const char * ha = lo_address_get_hostname(a);
+	const char * hb = lo_address_get_hostname(b);
+
+	/* unix socket addresses have no host */
+	if (lo_address_get_protocol(a) != lo_address_get_protocol(b))
+		return 0;
+	if ((ha || hb) && (!ha || !hb || strcmp(ha, hb)))
+		return 0;
+
+	return !strcmp(lo_address_get_port(a), lo_address_get_port(b));
 }
 
 static int add_listener(struct sios_object * obj, lo_address addr)
@@ -109,8 +288,7 @@ static int add_listener(struct sios_object * obj, lo_address addr)
 		return -1;
 
 	list_for_each_entry(l, &obj->listeners, listener) {
-		if (!strcmp(lo_address_get_hostname(addr), lo_address_get_hostname(l->address)) &&
-				!strcmp(lo_address_get_port(addr), lo_address_get_port(l->address))) {
+		if (sios_osc_address_equal(addr, l->address)) {
 			warn("OSC", "%s:%s already a listener for module %s", 
 					  lo_address_get_hostname(addr),
 					  lo_address_get_port(addr),
@@ -140,8 +318,7 @@ static void del_listener(struct sios_object * obj, lo_address addr)
 
 	if (!addr) return;
 	list_for_each_entry(l, &obj->listeners, listener) {
-		if (!strcmp(lo_address_get_hostname(addr), lo_address_get_hostname(l->address)) &&
-				!strcmp(lo_address_get_port(addr), lo_address_get_port(l->address))) {
+		if (sios_osc_address_equal(addr, l->address)) {
 			found = 1;
 			break;
 		}
@@ -158,12 +335,19 @@ static void del_listener(struct sios_object * obj, lo_address addr)
 	}
 }
 
-static lo_address fetch_address_from_handler(lo_message msg, const char * types, int argc, lo_arg **argv)
+lo_address sios_osc_listener_address(lo_message msg, const char * types, int argc, lo_arg **argv)
 {
-	lo_address addr, t = lo_message_get_source(msg);
-
-	if (argc < 2) {
-		addr = lo_address_new(lo_address_get_hostname(t), lo_address_get_port(t));
+	lo_address addr, t;
+
+	if (argc == 1 && types[0] == 's' && (&argv[0]->s)[0] == '/') {
+		/* a local client's unix socket */
+		addr = lo_address_new_with_proto(LO_UNIX, NULL, &argv[0]->s);
+	} else if (argc < 2) {
+		t = sios_osc_get_source(msg);
+		if (!t)
+			return NULL;
+		addr = lo_address_new_with_proto(lo_address_get_protocol(t),
+						 lo_address_get_hostname(t), lo_address_get_port(t));
 	} else {
 		if (types[1] == 'i') {
 			char port[6];
@@ -186,7 +370,7 @@ static int add_listen_source_handler(const char *path, const char *types, lo_arg
 	if (!desc || !desc->obj)
 		return -1;
 
-	addr = fetch_address_from_handler(msg, types, argc, argv);
+	addr = sios_osc_listener_address(msg, types, argc, argv);
 
 	if (add_listener(desc->obj, addr)) {
 		lo_address_free(addr);
@@ -205,7 +389,7 @@ static int del_listen_source_handler(const char *path, const char *types, lo_arg
 	if (!desc || !desc->obj)
 		return -1;
 
-	addr = fetch_address_from_handler(msg, types, argc, argv);
+	addr = sios_osc_listener_address(msg, types, argc, argv);
 
 	del_listener(desc->obj, addr);
 	lo_address_free(addr);
@@ -290,7 +474,6 @@ struct sios_param_desc * sios_new_param_desc(const char * name, const char * met
 
 int sios_osc_add_method_desc(struct sios_method_desc * desc)
 {
-	lo_method * method;
 	struct sios_object * obj;
 	char path[SIOS_MAX_PATHSIZE];
 
@@ -302,15 +485,12 @@ int sios_osc_add_method_desc(struct sios_method_desc * desc)
 
 	snprintf(path, SIOS_MAX_PATHSIZE, "%s/%s", obj->path, desc->m_addr);
 	dbg("method path: %s", path);
-	method = lo_server_add_method(udp_server, 
-				      path, desc->typespec ,
-				      desc->handler, desc);
-
-	if (!method) return -1;
+	if (sios_dispatch_add(path, desc))
+		return -1;
 	
 	INIT_LIST_HEAD(&desc->method);
 	list_add(&desc->method, &obj->osc_methods);
-	desc->lo_m = method;
+	desc->lo_m = NULL;
 
 	return 0;
 }
@@ -329,7 +509,6 @@ int sios_osc_add_method_descs(struct sios_method_desc * desc, int cnt)
 
 int sios_osc_add_param_desc(struct sios_param_desc * desc)
 {
-	lo_method * method;
 	struct sios_object * obj;
 	char path[SIOS_MAX_PATHSIZE];
 
@@ -337,14 +516,12 @@ int sios_osc_add_param_desc(struct sios_param_desc * desc)
 	if ((obj = desc->obj) == NULL) return -1;
 
 	snprintf(path, SIOS_MAX_PATHSIZE, "%s/%s", obj->path, desc->name);
-	method = lo_server_add_method(udp_server, path, desc->typespec,
-					 desc->handler, desc);
-
-	if (!method) return -1;
+	if (sios_dispatch_add(path, (struct sios_method_desc*)desc))
+		return -1;
 	
 	INIT_LIST_HEAD(&desc->param);
 	list_add(&desc->param, &obj->osc_params);
-	desc->lo_m = method;
+	desc->lo_m = NULL;
 
 	return 0;
 }
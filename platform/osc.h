@@ -21,6 +21,8 @@
 #ifndef OSC_H
 #define OSC_H
 
+#include <sys/types.h>
+#include <sys/socket.h>
 #include <lo/lo.h>
 
 #include "sios.h"
@@ -33,7 +35,12 @@ typedef int (*osc_handler)(const char *path, const char *types, lo_arg **argv,
 
 int sios_osc_init(struct osc_entry * osc);
 void sios_osc_terminate();
+void sios_osc_print_stats(void);
+int sios_osc_wait(int fd, double timeout);
 void sios_osc_add_listener_handlers(struct sios_object * obj); 
+lo_address sios_osc_get_source(lo_message msg);
+int sios_osc_address_equal(lo_address a, lo_address b);
+lo_address sios_osc_listener_address(lo_message msg, const char * types, int argc, lo_arg **argv);
 struct sios_method_desc * sios_new_method_desc(const char * name, const char * method,
 					       const char * types, osc_handler handler, 
 					       const char * descr);
@@ -45,6 +52,27 @@ int sios_osc_add_method_descs(struct sios_method_desc * desc, int cnt);
 int sios_osc_add_param_desc(struct sios_param_desc * desc);
 int sios_osc_add_param_descs(struct sios_param_desc * desc, int cnt);
 
+int sios_osc_receivers_init(int port, int threads);
+void sios_osc_receivers_exit(void);
+void sios_osc_receivers_print_stats(void);
+int sios_osc_unix_init(const char * path);
+int sios_osc_priority_init(int port);
+int sios_osc_bin_init(int port);
+int sios_bin_dispatch(int fd, const void * buf, size_t size,
+		      const struct sockaddr * from, socklen_t fromlen);
+void sios_osc_set_source(const struct sockaddr * addr, socklen_t len);
+
+int sios_osc_sched_init(void);
+void sios_osc_sched_exit(void);
+void sios_osc_sched_print_stats(void);
+int sios_osc_schedule(const char * path, lo_message msg, lo_timetag tt,
+		      const struct sockaddr * src, socklen_t src_len, unsigned int flags);
+
+int sios_dispatch_add(const char * path, struct sios_method_desc * desc);
+void sios_dispatch_del(struct sios_method_desc * desc);
+int sios_dispatch(const char * path, lo_message msg);
+int sios_dispatch_flags(const char * path, lo_message msg, unsigned int flags);
+
 struct listener {
 	lo_address address;
 	struct list_head listener;	
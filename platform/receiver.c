@@ -0,0 +1,544 @@
+/**
+ *  @file receiver.c
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sios.h"
+#include "osc.h"
+#include "stream.h"
+
+/* largest datagram we accept, matches the liblo limit */
+#define OSC_MAX_PACKET		32768
+
+#define OSC_BUNDLE_TAG		"#bundle"
+#define OSC_BUNDLE_HDR		16
+
+/* latency histogram buckets, bucket n counts latencies below 2^n usec */
+#define LATENCY_BUCKETS		24
+
+/* SCHED_FIFO priority of the priority port's receiver */
+#define PRIORITY_RT_PRIO	10
+
+/**
+ * A SIOS owned OSC receiver.
+ *
+ * Every receiver owns a socket and a thread reading from it. Incoming
+ * packets are dispatched through the shared SIOS method table instead of
+ * a liblo server, so several receivers can serve the same methods.
+ */
+struct osc_receiver {
+	int num;			/**< Receiver number, for reporting */
+	int fd;				/**< Socket file descriptor */
+	pthread_t thread;		/**< Receiving thread */
+	unsigned long packets;		/**< Packets received */
+	unsigned long bytes;		/**< Bytes received */
+	unsigned long malformed;	/**< Packets that failed to parse */
+	unsigned long unhandled;	/**< Messages without a matching method */
+	uint32_t drops;			/**< Packets dropped by the kernel (SO_RXQ_OVFL) */
+	char * unix_path;		/**< Socket path of an AF_UNIX receiver */
+	unsigned int flags;		/**< Only call methods with these SIOS_METHOD_* flags */
+	int binary;			/**< Serves the binary protocol, see sios_bin.h */
+	int priority;			/**< Served by a realtime thread */
+
+	/* kernel receive (SO_TIMESTAMPNS) to dispatch done */
+	unsigned long lat_count;	/**< Packets with a latency sample */
+	uint64_t lat_sum;		/**< Sum of latencies, nsec */
+	uint64_t lat_max;		/**< Worst latency, nsec */
+	unsigned long lat_hist[LATENCY_BUCKETS];	/**< Log2 usec histogram */
+
+	struct list_head list;		/**< list_head entry for receiver_list */
+};
+
+static LIST_HEAD(receiver_list);
+
+/* source of the packet being dispatched by the current thread */
+static __thread const struct sockaddr * cur_src_addr = NULL;
+static __thread socklen_t cur_src_len = 0;
+static __thread lo_address cur_src = NULL;
+
+void sios_osc_set_source(const struct sockaddr * addr, socklen_t len)
+{
+	if (cur_src) {
+		lo_address_free(cur_src);
+		cur_src = NULL;
+	}
+	cur_src_addr = addr;
+	cur_src_len = len;
+}
+
+lo_address sios_osc_get_source(lo_message msg)
+{
+	char host[NI_MAXHOST], port[NI_MAXSERV];
+
+	if (!cur_src_addr)
+		return lo_message_get_source(msg);
+
+	/* only build a liblo address for handlers that ask for it */
+	if (!cur_src && cur_src_addr->sa_family == AF_UNIX) {
+		const struct sockaddr_un * sun = (const struct sockaddr_un*)cur_src_addr;
+
+		/* unbound clients can't be answered */
+		if (cur_src_len <= offsetof(struct sockaddr_un, sun_path) || !sun->sun_path[0])
+			return NULL;
+		cur_src = lo_address_new_with_proto(LO_UNIX, NULL, sun->sun_path);
+	} else if (!cur_src) {
+		if (getnameinfo(cur_src_addr, cur_src_len,
+				host, sizeof(host), port, sizeof(port),
+				NI_NUMERICHOST | NI_NUMERICSERV))
+			return NULL;
+		cur_src = lo_address_new(host, port);
+	}
+
+	return cur_src;
+}
+
+static int dispatch_message(struct osc_receiver * r, char * data, size_t size, lo_timetag * tt)
+{
+	lo_message msg;
+	int result;
+
+	msg = lo_message_deserialise(data, size, &result);
+	if (!msg)
+		return -1;
+
+	/* bundled messages wait for their timetag */
+	if (tt) {
+		result = sios_osc_schedule(data, msg, *tt, cur_src_addr, cur_src_len, r->flags);
+		if (result <= 0) {
+			if (result < 0)
+				lo_message_free(msg);
+			return 0;
+		}
+	}
+
+	/* the path is the first, validated, string of the message */
+	if (!sios_dispatch_flags(data, msg, r->flags))
+		r->unhandled++;
+
+	lo_message_free(msg);
+	return 0;
+}
+
+static int dispatch_packet(struct osc_receiver * r, char * data, size_t size, lo_timetag * outer)
+{
+	char * pos, * end;
+	lo_timetag tt;
+	uint32_t len;
+	int retval = 0;
+
+	if (size < OSC_BUNDLE_HDR || memcmp(data, OSC_BUNDLE_TAG, sizeof(OSC_BUNDLE_TAG)))
+		return dispatch_message(r, data, size, outer);
+
+	memcpy(&tt.sec, data + 8, sizeof(tt.sec));
+	memcpy(&tt.frac, data + 12, sizeof(tt.frac));
+	tt.sec = ntohl(tt.sec);
+	tt.frac = ntohl(tt.frac);
+
+	/* a bundle is one transaction for the actuators it touches */
+	sios_sources_begin();
+	pos = data + OSC_BUNDLE_HDR;
+	end = data + size;
+	while (pos + sizeof(len) <= end) {
+		memcpy(&len, pos, sizeof(len));
+		len = ntohl(len);
+		pos += sizeof(len);
+		if (len > (uint32_t)(end - pos) || (len & 0x3)) {
+			retval = -1;
+			break;
+		}
+		if (dispatch_packet(r, pos, len, &tt))
+			retval = -1;
+		pos += len;
+	}
+	sios_sources_commit();
+
+	return retval;
+}
+
+static void receiver_account_latency(struct osc_receiver * r, const struct timespec * rx)
+{
+	struct timespec now;
+	int64_t lat;
+	int b;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	lat = (int64_t)(now.tv_sec - rx->tv_sec) * 1000000000LL + (now.tv_nsec - rx->tv_nsec);
+	if (lat < 0)
+		return;
+
+	r->lat_count++;
+	r->lat_sum += lat;
+	if ((uint64_t)lat > r->lat_max)
+		r->lat_max = lat;
+
+	for (b = 0, lat /= 1000; lat && b < LATENCY_BUCKETS - 1; b++)
+		lat >>= 1;
+	r->lat_hist[b]++;
+}
+
+static void * receiver_thread(void * arg)
+{
+	struct osc_receiver * r = (struct osc_receiver*)arg;
+	char buf[OSC_MAX_PACKET];
+	char cbuf[CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct timespec))];
+	struct sockaddr_storage from;
+	struct timespec rx;
+	struct cmsghdr * cmsg;
+	struct msghdr mh;
+	struct iovec iov;
+	ssize_t n;
+	int retval;
+
+	dbg("osc receiver %d started", r->num);
+	while (sios_osc_wait(r->fd, -1) >= 0) {
+		/* drain the socket before going back to sleep */
+		while (1) {
+			iov.iov_base = buf;
+			iov.iov_len = sizeof(buf);
+			memset(&mh, 0, sizeof(mh));
+			mh.msg_name = &from;
+			mh.msg_namelen = sizeof(from);
+			mh.msg_iov = &iov;
+			mh.msg_iovlen = 1;
+			mh.msg_control = cbuf;
+			mh.msg_controllen = sizeof(cbuf);
+
+			n = recvmsg(r->fd, &mh, MSG_DONTWAIT);
+			/* samples to binary clients go out of this socket, the
+			 * ICMP errors they bounce with fail the read */
+			if (n < 0 && r->binary && sios_streams_read_errors(r->fd))
+				continue;
+			if (n <= 0)
+				break;
+
+			rx.tv_sec = 0;
+			for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+#ifdef SO_RXQ_OVFL
+				if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+					memcpy(&r->drops, CMSG_DATA(cmsg), sizeof(r->drops));
+#endif
+#ifdef SCM_TIMESTAMPNS
+				if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+					memcpy(&rx, CMSG_DATA(cmsg), sizeof(rx));
+#endif
+			}
+
+			r->packets++;
+			r->bytes += n;
+
+			sios_osc_set_source((struct sockaddr*)&from, mh.msg_namelen);
+			if (r->binary) {
+				retval = sios_bin_dispatch(r->fd, buf, n, (struct sockaddr*)&from,
+							   mh.msg_namelen);
+				if (retval < 0)
+					r->malformed++;
+				else if (retval > 0)
+					r->unhandled++;
+			} else if (dispatch_packet(r, buf, n, NULL)) {
+				r->malformed++;
+			}
+			sios_osc_set_source(NULL, 0);
+
+			if (rx.tv_sec)
+				receiver_account_latency(r, &rx);
+		}
+	}
+
+	dbg("osc receiver %d stopped", r->num);
+	return NULL;
+}
+
+/* kernel receive timestamps, for the latency statistics */
+static void enable_timestamps(int fd)
+{
+#ifdef SO_TIMESTAMPNS
+	int one = 1;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)))
+		dbg("no receive timestamps: %s", strerror(errno));
+#endif
+}
+
+static int open_udp_socket(int port, int reuseport)
+{
+	struct sockaddr_in addr;
+	int fd, one = 1;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if (reuseport) {
+#ifdef SO_REUSEPORT
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)))
+			goto err;
+#else
+		errno = ENOPROTOOPT;
+		goto err;
+#endif
+	}
+
+#ifdef SO_RXQ_OVFL
+	if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)))
+		warn("OSC", "kernel drop counters not available: %s", strerror(errno));
+#endif
+	enable_timestamps(fd);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)))
+		goto err;
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return fd;
+
+err:
+	close(fd);
+	return -1;
+}
+
+static int open_unix_socket(const char * path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* a stale socket of a previous run would make bind fail */
+	unlink(path);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+	enable_timestamps(fd);
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return fd;
+}
+
+static int start_receiver(int fd, char * unix_path, unsigned int flags, int priority, int binary)
+{
+	static int num = 0;
+	struct osc_receiver * r;
+	struct sched_param param;
+	pthread_attr_t attr;
+	int retval;
+
+	r = (struct osc_receiver*)malloc(sizeof(struct osc_receiver));
+	if (!r) {
+		err("OSC", "out of memory while allocating receiver");
+		return -1;
+	}
+	memset(r, 0, sizeof(*r));
+	r->num = num++;
+	r->fd = fd;
+	r->unix_path = unix_path;
+	r->flags = flags;
+	r->binary = binary;
+	INIT_LIST_HEAD(&r->list);
+
+	retval = -1;
+	if (priority) {
+		/* actuator commands preempt everything else SIOS does */
+		pthread_attr_init(&attr);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		param.sched_priority = PRIORITY_RT_PRIO;
+		pthread_attr_setschedparam(&attr, &param);
+		retval = pthread_create(&r->thread, &attr, receiver_thread, r);
+		pthread_attr_destroy(&attr);
+		if (retval)
+			warn("OSC", "no realtime priority for receiver %d: %s", r->num, strerror(retval));
+		else
+			r->priority = 1;
+	}
+	if (retval)
+		retval = pthread_create(&r->thread, NULL, receiver_thread, r);
+	if (retval) {
+		err("OSC", "failed pthread_create");
+		free(r);
+		return retval;
+	}
+
+	list_add_tail(&r->list, &receiver_list);
+	return 0;
+}
+
+int sios_osc_receivers_init(int port, int threads)
+{
+	int i, fd;
+
+	for (i=0;i<threads;i++) {
+		fd = open_udp_socket(port, 1);
+		if (fd < 0) {
+			err("OSC", "failed binding udp port '%d' for receiver %d: %s",
+				port, i, strerror(errno));
+			return -1;
+		}
+
+		if (start_receiver(fd, NULL, 0, 0, 0)) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	info("OSC", "udp port %d, %d receiver threads", port, threads);
+	return 0;
+}
+
+int sios_osc_unix_init(const char * path)
+{
+	char * p;
+	int fd;
+
+	fd = open_unix_socket(path);
+	if (fd < 0) {
+		err("OSC", "failed binding unix socket '%s': %s", path, strerror(errno));
+		return -1;
+	}
+
+	p = strdup(path);
+	if (!p || start_receiver(fd, p, 0, 0, 0)) {
+		free(p);
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+
+	info("OSC", "unix socket %s", path);
+	return 0;
+}
+
+int sios_osc_priority_init(int port)
+{
+	int fd;
+
+	fd = open_udp_socket(port, 0);
+	if (fd < 0) {
+		err("OSC", "failed binding priority udp port '%d': %s", port, strerror(errno));
+		return -1;
+	}
+
+	if (start_receiver(fd, NULL, SIOS_METHOD_ACTUATOR, 1, 0)) {
+		close(fd);
+		return -1;
+	}
+
+	info("OSC", "udp priority port %d for actuator methods", port);
+	return 0;
+}
+
+int sios_osc_bin_init(int port)
+{
+	int fd;
+
+	fd = open_udp_socket(port, 0);
+	if (fd < 0) {
+		err("OSC", "failed binding binary protocol port '%d': %s", port, strerror(errno));
+		return -1;
+	}
+	if (sios_streams_watch_errors(fd))
+		warn("OSC", "no ICMP errors on the binary port, unreachable clients wait for their lease");
+
+	if (start_receiver(fd, NULL, 0, 0, 1)) {
+		close(fd);
+		return -1;
+	}
+
+	info("OSC", "binary protocol on udp port %d", port);
+	return 0;
+}
+
+void sios_osc_receivers_exit(void)
+{
+	struct osc_receiver * r, * tmp;
+
+	/* sios_osc_terminate() already woke up the threads */
+	list_for_each_entry_safe(r, tmp, &receiver_list, list) {
+		pthread_join(r->thread, NULL);
+		close(r->fd);
+		if (r->unix_path) {
+			unlink(r->unix_path);
+			free(r->unix_path);
+		}
+		list_del(&r->list);
+		free(r);
+	}
+}
+
+void sios_osc_receivers_print_stats(void)
+{
+	struct osc_receiver * r;
+	unsigned long n;
+	int b;
+
+	list_for_each_entry(r, &receiver_list, list) {
+		info("OSC", "receiver %d (%s%s%s%s): %lu packets, %lu bytes, %lu malformed, "
+			    "%lu unhandled, %u dropped by kernel",
+			    r->num, r->unix_path ? r->unix_path : "udp",
+			    r->flags & SIOS_METHOD_ACTUATOR ? " priority" : "",
+			    r->priority ? " realtime" : "",
+			    r->binary ? " binary" : "",
+			    r->packets, r->bytes, r->malformed,
+			    r->unhandled, r->drops);
+
+		if (!r->lat_count)
+			continue;
+
+		/* upper bound of the bucket holding the 99th percentile */
+		for (b = 0, n = 0; b < LATENCY_BUCKETS - 1; b++) {
+			n += r->lat_hist[b];
+			if (n * 100 >= r->lat_count * 99)
+				break;
+		}
+		info("OSC", "receiver %d latency: mean %llu usec, p99 < %lu usec, max %llu usec",
+			    r->num, (unsigned long long)(r->lat_sum / r->lat_count / 1000),
+			    1UL << b, (unsigned long long)(r->lat_max / 1000));
+	}
+}
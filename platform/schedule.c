@@ -0,0 +1,266 @@
+/**
+ *  @file schedule.c
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sios.h"
+#include "osc.h"
+
+/* seconds between the NTP epoch (1900) used by OSC and the unix epoch */
+#define NTP_UNIX_OFFSET		2208988800UL
+
+/* bounds the memory a sender can pin with far future bundles */
+#define SCHED_MAX_PENDING	1024
+
+/**
+ * A bundled OSC message waiting for its timetag.
+ */
+struct sched_entry {
+	struct timespec when;			/**< Timetag as CLOCK_REALTIME time */
+	char path[SIOS_MAX_PATHSIZE];		/**< Address of the message */
+	lo_message msg;				/**< The message itself */
+	struct sockaddr_storage src;		/**< Sender, for sios_osc_get_source() */
+	socklen_t src_len;			/**< Length of src, 0 if unknown */
+	unsigned int flags;			/**< Method flags required by the receiver */
+	struct list_head list;			/**< list_head entry for sched_list, earliest first */
+};
+
+static LIST_HEAD(sched_list);
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t sched_thread;
+static int sched_running = 0;
+static int sched_halt = 0;
+
+static int sched_pending = 0;
+static unsigned long sched_queued = 0;
+static unsigned long sched_late = 0;
+static unsigned long sched_dropped = 0;
+
+static inline void timetag_to_timespec(struct timespec * ts, lo_timetag tt)
+{
+	ts->tv_sec = (time_t)(tt.sec - NTP_UNIX_OFFSET);
+	ts->tv_nsec = (long)(((uint64_t)tt.frac * 1000000000ULL) >> 32);
+}
+
+static inline int timespec_before(const struct timespec * a, const struct timespec * b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec;
+	return a->tv_nsec < b->tv_nsec;
+}
+
+static void sched_entry_free(struct sched_entry * e)
+{
+	lo_message_free(e->msg);
+	free(e);
+}
+
+/* only call with sched_lock held */
+static void sched_insert(struct sched_entry * e)
+{
+	struct list_head * ptr;
+
+	/* walk back from the latest entry, equal timetags keep arrival order */
+	for (ptr = sched_list.prev; ptr != &sched_list; ptr = ptr->prev) {
+		struct sched_entry * entry;
+		entry = container_of(ptr, struct sched_entry, list);
+		if (!timespec_before(&e->when, &entry->when))
+			break;
+	}
+	__list_add(&e->list, ptr, ptr->next);
+
+	/* a new earliest entry shortens the scheduler's wait */
+	if (sched_list.next == &e->list)
+		pthread_cond_signal(&sched_cond);
+}
+
+/**
+ * Queue a bundled message until its timetag.
+ *
+ * flags restrict the methods it may call, see sios_dispatch_flags().
+ *
+ * Returns 0 if the message was queued, the scheduler then owns it. Returns
+ * 1 if the message is due now, late ones are counted, and -1 if it had to
+ * be dropped. In both cases the caller keeps the message.
+ */
+int sios_osc_schedule(const char * path, lo_message msg, lo_timetag tt,
+		      const struct sockaddr * src, socklen_t src_len, unsigned int flags)
+{
+	struct sched_entry * e;
+	struct timespec when, now;
+
+	if (tt.sec == 0 && tt.frac == 1)	/* immediately */
+		return 1;
+
+	timetag_to_timespec(&when, tt);
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	pthread_mutex_lock(&sched_lock);
+	if (!sched_running) {
+		pthread_mutex_unlock(&sched_lock);
+		return 1;
+	}
+	if (!timespec_before(&now, &when)) {
+		sched_late++;
+		pthread_mutex_unlock(&sched_lock);
+		return 1;
+	}
+	if (sched_pending >= SCHED_MAX_PENDING) {
+		sched_dropped++;
+		pthread_mutex_unlock(&sched_lock);
+		return -1;
+	}
+	/* reserve the slot, other receiver threads check the bound too */
+	sched_pending++;
+	pthread_mutex_unlock(&sched_lock);
+
+	e = (struct sched_entry*)malloc(sizeof(struct sched_entry));
+	if (!e) {
+		pthread_mutex_lock(&sched_lock);
+		sched_pending--;
+		pthread_mutex_unlock(&sched_lock);
+		err("OSC", "out of memory while scheduling '%s'", path);
+		return -1;
+	}
+	e->when = when;
+	snprintf(e->path, SIOS_MAX_PATHSIZE, "%s", path);
+	e->msg = msg;
+	e->flags = flags;
+	e->src_len = 0;
+	if (src && src_len <= sizeof(e->src)) {
+		memcpy(&e->src, src, src_len);
+		e->src_len = src_len;
+	}
+	INIT_LIST_HEAD(&e->list);
+
+	pthread_mutex_lock(&sched_lock);
+	sched_insert(e);
+	sched_queued++;
+	pthread_mutex_unlock(&sched_lock);
+
+	return 0;
+}
+
+static void * sched_thread_func(void * arg)
+{
+	struct sched_entry * e, * tmp;
+	struct timespec now;
+	LIST_HEAD(due);
+
+	dbg("osc scheduler started");
+	pthread_mutex_lock(&sched_lock);
+	while (!sched_halt) {
+		if (list_empty(&sched_list)) {
+			pthread_cond_wait(&sched_cond, &sched_lock);
+			continue;
+		}
+
+		e = list_entry(sched_list.next, struct sched_entry, list);
+		clock_gettime(CLOCK_REALTIME, &now);
+		if (timespec_before(&now, &e->when)) {
+			pthread_cond_timedwait(&sched_cond, &sched_lock, &e->when);
+			continue;
+		}
+
+		/* everything that is due, typically one bundle, is a 
+		 * single transaction for the actuators */
+		list_for_each_entry_safe(e, tmp, &sched_list, list) {
+			if (timespec_before(&now, &e->when))
+				break;
+			list_move_tail(&e->list, &due);
+			sched_pending--;
+		}
+		pthread_mutex_unlock(&sched_lock);
+
+		/* handlers run without the lock, they may schedule themselves */
+		sios_sources_begin();
+		list_for_each_entry_safe(e, tmp, &due, list) {
+			list_del(&e->list);
+			sios_osc_set_source(e->src_len ? (struct sockaddr*)&e->src : NULL, e->src_len);
+			sios_dispatch_flags(e->path, e->msg, e->flags);
+			sios_osc_set_source(NULL, 0);
+			sched_entry_free(e);
+		}
+		sios_sources_commit();
+
+		pthread_mutex_lock(&sched_lock);
+	}
+	pthread_mutex_unlock(&sched_lock);
+
+	dbg("osc scheduler stopped");
+	return NULL;
+}
+
+int sios_osc_sched_init(void)
+{
+	int retval;
+
+	sched_halt = 0;
+	retval = pthread_create(&sched_thread, NULL, sched_thread_func, NULL);
+	if (retval) {
+		err("OSC", "failed starting scheduler thread");
+		return retval;
+	}
+
+	pthread_mutex_lock(&sched_lock);
+	sched_running = 1;
+	pthread_mutex_unlock(&sched_lock);
+
+	return 0;
+}
+
+void sios_osc_sched_exit(void)
+{
+	struct sched_entry * e, * tmp;
+
+	if (!sched_running)
+		return;
+
+	pthread_mutex_lock(&sched_lock);
+	sched_halt = 1;
+	sched_running = 0;
+	pthread_cond_signal(&sched_cond);
+	pthread_mutex_unlock(&sched_lock);
+
+	pthread_join(sched_thread, NULL);
+
+	/* whatever is still pending will never run */
+	list_for_each_entry_safe(e, tmp, &sched_list, list) {
+		list_del(&e->list);
+		sched_entry_free(e);
+	}
+	sched_pending = 0;
+}
+
+void sios_osc_sched_print_stats(void)
+{
+	pthread_mutex_lock(&sched_lock);
+	info("OSC", "scheduler: %lu queued, %d pending, %lu late, %lu dropped",
+		    sched_queued, sched_pending, sched_late, sched_dropped);
+	pthread_mutex_unlock(&sched_lock);
+}
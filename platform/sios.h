@@ -417,12 +417,17 @@ struct sios_method_desc {
 	lo_method lo_m;				/**< Liblo method implementation */
 	struct list_head method;		/**< list head entry used to register method */
 	void * priv;				/**< private data */
+	unsigned int flags;			/**< SIOS_METHOD_* flags */
 };
 
+/** The method drives an actuator, it is served on the OSC priority port */
+#define SIOS_METHOD_ACTUATOR	0x01
+
 /**
  * Structure describing an exported OSC parameter.
  * 
- * Internally parameters and methods share the same OSC implementation.
+ * Internally parameters and methods share the same OSC implementation,
+ * so the layout must match struct sios_method_desc field by field.
  */
 struct sios_param_desc {
 	struct sios_object * obj;		/**< The owning sios_object */
@@ -434,6 +439,7 @@ struct sios_param_desc {
 	lo_method lo_m;				/**< Liblo method implementation */
 	struct list_head param;			/**< list head entry used to register parameter */
 	void * priv;				/**< private data */
+	unsigned int flags;			/**< SIOS_METHOD_* flags */
 };
 
 #define METHOD_DESCRIPTORS(_md)	(sizeof((_md)) / sizeof(struct sios_method_desc))
@@ -511,6 +517,21 @@ int sios_source_ctx_exists(struct sios_source_ctx * ctx);
  */
 int sios_add_source_ctx(struct sios_source_ctx * ctx);
 
+/**
+ * Starts a writer transaction.
+ *
+ * Until sios_sources_commit() the writer loop does not run, and writer
+ * contexts added from this thread are made due on its next pass, so all
+ * their writes happen together. Adding a writer context that is queued
+ * already succeeds and leaves its timing alone. Transactions nest.
+ */
+void sios_sources_begin(void);
+
+/**
+ * Ends a writer transaction started with sios_sources_begin().
+ */
+void sios_sources_commit(void);
+
 /**
  * Removes a sios_source_ctx.
  *
@@ -0,0 +1,243 @@
+/**
+ *  @file sios_bin.h
+ *
+ *  Binary stream protocol, wire layout and reference codec.
+ *
+ *  An alternative to OSC for consumers that only want samples fast. SIOS
+ *  serves it on its own UDP port (osc_bin_port). Every datagram is a
+ *  fixed header followed by a fixed layout payload, there is no padding,
+ *  type tag or string parsing. This header has no dependencies on the
+ *  rest of SIOS besides sios_shm.h, clients can copy both as is.
+ *
+ *  A client sends SIOS_BIN_LISTEN with the OSC path of a stream, e.g.
+ *  "/sios/sensors/accmag/acc/data", and gets the request back with the stream
+ *  id filled in, 0 if the stream does not exist. Samples follow as
+ *  SIOS_BIN_SAMPLE datagrams carrying that id, the stream's sequence
+ *  number and capture time, and the stream's record as payload: a
+ *  struct sios_shm_accmag for the accmag acc and mag streams, a struct
+ *  sios_shm_orientation for its orientation stream, a struct
+ *  sios_shm_spectrum for its spectrum stream, a struct
+ *  sios_shm_gesture for its gesture stream and a struct
+ *  sios_shm_matrix for the matrix. SIOS_BIN_SILENCE with the id stops
+ *  them. SIOS_BIN_COMMAND calls an OSC method with up to
+ *  SIOS_BIN_MAX_ARGS int or float arguments.
+ *
+ *  All fields are little endian. Payload records are sent as they are
+ *  published, so the platform does not build for a big endian board.
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef SIOS_BIN_H
+#define SIOS_BIN_H
+
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sios_shm.h"
+
+#define SIOS_BIN_MAGIC		0x5342		/* "SB" */
+#define SIOS_BIN_VERSION	1
+
+/* longest path, NUL included, and most arguments of a command */
+#define SIOS_BIN_PATHSIZE	64
+#define SIOS_BIN_MAX_ARGS	8
+
+/* largest datagram SIOS sends or accepts */
+#define SIOS_BIN_MAX_PACKET	1024
+
+/**
+ * Datagram types.
+ */
+enum sios_bin_type {
+	SIOS_BIN_SAMPLE = 1,		/**< A stream sample, SIOS to client */
+	SIOS_BIN_LISTEN,		/**< Subscribe, struct sios_bin_listen, answered in kind */
+	SIOS_BIN_SILENCE,		/**< Unsubscribe from the stream in the header */
+	SIOS_BIN_COMMAND,		/**< Call a method, struct sios_bin_command */
+};
+
+/**
+ * Datagram header.
+ */
+struct sios_bin_header {
+	uint16_t magic;			/**< SIOS_BIN_MAGIC */
+	uint8_t version;		/**< SIOS_BIN_VERSION */
+	uint8_t type;			/**< enum sios_bin_type */
+	uint16_t stream;		/**< Stream id, 0 for none */
+	uint16_t length;		/**< Payload bytes after the header */
+	uint32_t seq;			/**< Sequence number of a sample */
+	uint32_t reserved;
+	uint64_t timestamp;		/**< Capture time of a sample, microseconds since the epoch */
+};
+
+/**
+ * Payload of SIOS_BIN_LISTEN.
+ */
+struct sios_bin_listen {
+	uint32_t lease;			/**< Seconds, 0 for the default */
+	uint16_t queue;			/**< Queue length, 0 for the default */
+	uint8_t policy;			/**< Overflow policy: drop oldest, drop newest, coalesce */
+	uint8_t reserved;
+	char path[SIOS_BIN_PATHSIZE];	/**< OSC path of the stream */
+};
+
+/**
+ * Payload of SIOS_BIN_COMMAND.
+ */
+struct sios_bin_command {
+	char path[SIOS_BIN_PATHSIZE];	/**< OSC path of the method */
+	char types[SIOS_BIN_MAX_ARGS];	/**< 'i' or 'f' per argument, NUL padded */
+	union {
+		int32_t i;
+		float f;
+	} args[SIOS_BIN_MAX_ARGS];	/**< The arguments */
+};
+
+static inline void sios_bin_header_init(struct sios_bin_header * hdr, enum sios_bin_type type,
+					unsigned int stream, unsigned int length)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = htole16(SIOS_BIN_MAGIC);
+	hdr->version = SIOS_BIN_VERSION;
+	hdr->type = type;
+	hdr->stream = htole16(stream);
+	hdr->length = htole16(length);
+}
+
+/**
+ * Check a datagram and convert its header to host order.
+ *
+ * @param payload Set to the payload, hdr->length bytes
+ * @return 0 on success, -1 if it is not a valid datagram
+ */
+static inline int sios_bin_decode(const void * buf, size_t len, struct sios_bin_header * hdr,
+				  const void ** payload)
+{
+	if (len < sizeof(*hdr))
+		return -1;
+
+	memcpy(hdr, buf, sizeof(*hdr));
+	hdr->magic = le16toh(hdr->magic);
+	hdr->stream = le16toh(hdr->stream);
+	hdr->length = le16toh(hdr->length);
+	hdr->seq = le32toh(hdr->seq);
+	hdr->timestamp = le64toh(hdr->timestamp);
+
+	if (hdr->magic != SIOS_BIN_MAGIC || hdr->version != SIOS_BIN_VERSION ||
+	    sizeof(*hdr) + hdr->length > len)
+		return -1;
+
+	*payload = (const char*)buf + sizeof(*hdr);
+	return 0;
+}
+
+/**
+ * Copy the record of a sample, the record size is known per stream.
+ *
+ * @return 0 on success, -1 if the payload does not match the record
+ */
+static inline int sios_bin_record(const struct sios_bin_header * hdr, const void * payload,
+				  void * record, size_t record_size)
+{
+	if (hdr->type != SIOS_BIN_SAMPLE || hdr->length != record_size)
+		return -1;
+
+	memcpy(record, payload, record_size);
+	return 0;
+}
+
+/**
+ * Build a SIOS_BIN_LISTEN request.
+ *
+ * @param buf At least sizeof(struct sios_bin_header) + sizeof(struct sios_bin_listen) bytes
+ * @return The datagram's length, -1 if the path is too long
+ */
+static inline int sios_bin_listen_request(void * buf, const char * path, unsigned int lease,
+					  unsigned int queue, unsigned int policy)
+{
+	struct sios_bin_header * hdr = (struct sios_bin_header*)buf;
+	struct sios_bin_listen * l = (struct sios_bin_listen*)(hdr + 1);
+
+	if (strlen(path) >= SIOS_BIN_PATHSIZE)
+		return -1;
+
+	sios_bin_header_init(hdr, SIOS_BIN_LISTEN, 0, sizeof(*l));
+	memset(l, 0, sizeof(*l));
+	l->lease = htole32(lease);
+	l->queue = htole16(queue);
+	l->policy = policy;
+	strcpy(l->path, path);
+
+	return sizeof(*hdr) + sizeof(*l);
+}
+
+/**
+ * Build a SIOS_BIN_SILENCE request.
+ */
+static inline int sios_bin_silence_request(void * buf, unsigned int stream)
+{
+	sios_bin_header_init((struct sios_bin_header*)buf, SIOS_BIN_SILENCE, stream, 0);
+	return sizeof(struct sios_bin_header);
+}
+
+/**
+ * Build a SIOS_BIN_COMMAND request, add arguments with
+ * sios_bin_command_add().
+ */
+static inline int sios_bin_command_request(void * buf, const char * path)
+{
+	struct sios_bin_header * hdr = (struct sios_bin_header*)buf;
+	struct sios_bin_command * c = (struct sios_bin_command*)(hdr + 1);
+
+	if (strlen(path) >= SIOS_BIN_PATHSIZE)
+		return -1;
+
+	sios_bin_header_init(hdr, SIOS_BIN_COMMAND, 0, sizeof(*c));
+	memset(c, 0, sizeof(*c));
+	strcpy(c->path, path);
+
+	return sizeof(*hdr) + sizeof(*c);
+}
+
+/**
+ * Append an argument, type 'i' takes i, 'f' takes f.
+ *
+ * @return 0 on success, -1 if the command is full
+ */
+static inline int sios_bin_command_add(void * buf, char type, int32_t i, float f)
+{
+	struct sios_bin_command * c = (struct sios_bin_command*)((struct sios_bin_header*)buf + 1);
+	uint32_t v;
+	int n;
+
+	n = strnlen(c->types, SIOS_BIN_MAX_ARGS);
+	if (n == SIOS_BIN_MAX_ARGS || (type != 'i' && type != 'f'))
+		return -1;
+
+	if (type == 'f')
+		memcpy(&v, &f, sizeof(v));
+	else
+		v = (uint32_t)i;
+	v = htole32(v);
+	memcpy(&c->args[n], &v, sizeof(v));
+	c->types[n] = type;
+
+	return 0;
+}
+
+#endif /* SIOS_BIN_H */
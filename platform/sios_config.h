@@ -40,6 +40,11 @@ struct osc_entry {
 	int port;
 	char do_udp;
 	char do_tcp;
+	int udp_threads;
+	char * unix_path;
+	int lease;
+	int priority_port;
+	int bin_port;
 };
 
 struct kword {
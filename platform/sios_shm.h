@@ -0,0 +1,234 @@
+/**
+ *  @file sios_shm.h
+ *
+ *  Shared memory stream rings, layout and reader.
+ *
+ *  SIOS publishes stream samples into rings in /dev/shm so local clients
+ *  can consume them without sockets or OSC decoding. This header has no
+ *  dependencies on the rest of SIOS, clients can copy it as is. Link
+ *  with -lrt on older C libraries.
+ *
+ *  A ring is a header followed by a power of two number of slots. The
+ *  single writer bumps a slot's sequence number after filling it and
+ *  then the ring's head. Readers never write to the ring, a reader
+ *  that falls more than a ring behind skips ahead and counts the lost
+ *  records.
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef SIOS_SHM_H
+#define SIOS_SHM_H
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SIOS_SHM_MAGIC		0x534f4953	/* "SIOS" */
+#define SIOS_SHM_VERSION	1
+
+/* ring names are "/sios-<module>[-<stream>]", e.g. "/sios-accmag-acc",
+ * a '/' in the stream becomes '-': device 3 of accmag has "/sios-accmag-3-acc" */
+#define SIOS_SHM_PREFIX		"/sios-"
+
+#define sios_shm_barrier()	__sync_synchronize()
+
+/**
+ * Ring header, at offset 0 of the shared memory object.
+ */
+struct sios_shm_header {
+	uint32_t magic;			/**< SIOS_SHM_MAGIC */
+	uint32_t version;		/**< SIOS_SHM_VERSION */
+	uint32_t record_size;		/**< Bytes of record data per slot */
+	uint32_t slot_size;		/**< Bytes per slot, header included */
+	uint32_t slots;			/**< Number of slots, a power of two */
+	uint32_t reserved;
+	volatile uint64_t head;		/**< Number of records ever written */
+};
+
+/**
+ * Slot header, the record data follows it.
+ */
+struct sios_shm_slot {
+	volatile uint64_t seq;		/**< Record number + 1, 0 while being written */
+	uint64_t timestamp;		/**< Capture time, microseconds since the epoch */
+};
+
+#define SIOS_SHM_SLOT_SIZE(_record_size) \
+	((sizeof(struct sios_shm_slot) + (_record_size) + 7) & ~7)
+#define SIOS_SHM_SIZE(_slots,_record_size) \
+	(sizeof(struct sios_shm_header) + (size_t)(_slots) * SIOS_SHM_SLOT_SIZE(_record_size))
+#define SIOS_SHM_SLOT(_hdr,_n) \
+	((struct sios_shm_slot*)((char*)(_hdr) + sizeof(struct sios_shm_header) + \
+		(size_t)((_n) & ((_hdr)->slots - 1)) * (_hdr)->slot_size))
+#define SIOS_SHM_DATA(_slot)	((void*)((_slot) + 1))
+
+/**
+ * Record published by the accmag acc and mag streams.
+ */
+struct sios_shm_accmag {
+	int32_t dev;			/**< Device number */
+	int16_t x, y, z;		/**< Raw, offset corrected, sample */
+	int16_t pad;
+};
+
+/**
+ * Record published by the accmag orientation stream, angles in hundredths
+ * of a degree.
+ */
+struct sios_shm_orientation {
+	int32_t dev;			/**< Device number */
+	int32_t roll;			/**< Rotation about x, -18000..18000 */
+	int32_t pitch;			/**< Rotation about y, -9000..9000 */
+	int32_t heading;		/**< Tilt compensated magnetic heading, 0..35999 */
+};
+
+#define SIOS_SPECTRUM_BANDS	8
+
+/**
+ * Record published by the accmag spectrum stream, once per analysis
+ * window. Band i covers i / SIOS_SPECTRUM_BANDS to (i + 1) /
+ * SIOS_SPECTRUM_BANDS of half the sample rate.
+ */
+struct sios_shm_spectrum {
+	int32_t dev;			/**< Device number */
+	uint32_t peak;			/**< Dominant frequency, millihertz, 0 if unknown */
+	uint32_t band[SIOS_SPECTRUM_BANDS];	/**< RMS acceleration per band, 1/256 counts */
+};
+
+#define SIOS_GESTURE_NAMESIZE	24
+
+/**
+ * Record published by the accmag gesture stream, only when a gesture
+ * is recognized.
+ */
+struct sios_shm_gesture {
+	int32_t dev;			/**< Device number */
+	char name[SIOS_GESTURE_NAMESIZE];	/**< Gesture, NUL terminated */
+};
+
+/**
+ * Record published by the matrix stream, cells in sensor order.
+ */
+struct sios_shm_matrix {
+	uint16_t cells[64];		/**< 12 bit pressure values */
+};
+
+/**
+ * Reader state, one per client.
+ */
+struct sios_shm_reader {
+	struct sios_shm_header * hdr;	/**< The mapped ring */
+	size_t size;			/**< Size of the mapping */
+	uint64_t next;			/**< Next record number to read */
+	unsigned long lost;		/**< Records overwritten before they were read */
+};
+
+/**
+ * Map a ring read-only and start reading at its current head.
+ *
+ * @return 0 on success, -1 on failure with errno set
+ */
+static inline int sios_shm_reader_open(struct sios_shm_reader * r, const char * name)
+{
+	struct stat st;
+	int fd;
+
+	memset(r, 0, sizeof(*r));
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct sios_shm_header)) {
+		close(fd);
+		return -1;
+	}
+
+	r->hdr = (struct sios_shm_header*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (r->hdr == MAP_FAILED) {
+		r->hdr = NULL;
+		return -1;
+	}
+	r->size = st.st_size;
+
+	if (r->hdr->magic != SIOS_SHM_MAGIC || r->hdr->version != SIOS_SHM_VERSION ||
+	    r->size < SIOS_SHM_SIZE(r->hdr->slots, r->hdr->record_size)) {
+		munmap(r->hdr, r->size);
+		r->hdr = NULL;
+		return -1;
+	}
+
+	r->next = r->hdr->head;
+	return 0;
+}
+
+static inline void sios_shm_reader_close(struct sios_shm_reader * r)
+{
+	if (r->hdr)
+		munmap(r->hdr, r->size);
+	r->hdr = NULL;
+}
+
+/**
+ * Copy the next record, if any, into record (hdr->record_size bytes).
+ *
+ * @return 1 if a record was read, 0 if the reader is up to date
+ */
+static inline int sios_shm_read(struct sios_shm_reader * r, void * record, uint64_t * timestamp)
+{
+	struct sios_shm_header * hdr = r->hdr;
+	struct sios_shm_slot * slot;
+	uint64_t head, seq;
+
+	while (1) {
+		head = hdr->head;
+		sios_shm_barrier();
+		if (r->next == head)
+			return 0;
+
+		if (head - r->next > hdr->slots) {
+			r->lost += head - hdr->slots - r->next;
+			r->next = head - hdr->slots;
+		}
+
+		slot = SIOS_SHM_SLOT(hdr, r->next);
+		seq = slot->seq;
+		sios_shm_barrier();
+		if (seq == r->next + 1) {
+			memcpy(record, SIOS_SHM_DATA(slot), hdr->record_size);
+			if (timestamp)
+				*timestamp = slot->timestamp;
+			sios_shm_barrier();
+			if (slot->seq == seq) {
+				r->next++;
+				return 1;
+			}
+		}
+
+		/* the writer lapped us while copying */
+		r->lost++;
+		r->next++;
+	}
+}
+
+#endif /* SIOS_SHM_H */
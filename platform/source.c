@@ -18,6 +18,7 @@
  *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
 #include <limits.h>
@@ -29,7 +30,9 @@
 LIST_HEAD(readers_list);
 static pthread_mutex_t readers_list_lock = PTHREAD_MUTEX_INITIALIZER;
 LIST_HEAD(writers_list);
-static pthread_mutex_t writers_list_lock = PTHREAD_MUTEX_INITIALIZER;
+/* recursive, a transaction holds it while its handlers add contexts */
+static pthread_mutex_t writers_list_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static __thread int writers_transaction = 0;
 
 static void add_source_ctx_unlocked(struct sios_source_ctx * ctx)
 {
@@ -240,24 +243,51 @@ int sios_source_ctx_exists(struct sios_source_ctx * ctx)
 
 int sios_add_source_ctx(struct sios_source_ctx * ctx)
 {
-	if (sios_source_ctx_exists(ctx)) {
-		warn("Source", "source exists (%p)", ctx);
-		return -1;
-	}
-	
+	int retval = 0;
+
+	/* check and add under the list lock, handlers running in different 
+	 * OSC receiver threads may race to add the same context */
 	if (ctx->type & SIOS_POLL_READ) {
 		pthread_mutex_lock(&readers_list_lock);
-		add_source_ctx_unlocked(ctx);
+		if (sios_source_ctx_exists(ctx))
+			retval = -1;
+		else
+			add_source_ctx_unlocked(ctx);
 		pthread_mutex_unlock(&readers_list_lock);
 	}
 
 	if (ctx->type & SIOS_POLL_WRITE) {
 		pthread_mutex_lock(&writers_list_lock);
-		add_source_ctx_unlocked(ctx);
+		if (!sios_source_ctx_exists(ctx)) {
+			add_source_ctx_unlocked(ctx);
+			/* due on the next writer pass, together with the
+			 * rest of the transaction */
+			if (writers_transaction)
+				ctx->elapsed = ctx->period;
+		} else if (!writers_transaction) {
+			retval = -1;
+		}
+		/* in a transaction a queued context, e.g. a beep or flash
+		 * still waiting out its period, is fine and keeps its phase */
 		pthread_mutex_unlock(&writers_list_lock);
 	}
 
-	return 0;
+	if (retval)
+		warn("Source", "source exists (%p)", ctx);
+
+	return retval;
+}
+
+void sios_sources_begin(void)
+{
+	pthread_mutex_lock(&writers_list_lock);
+	writers_transaction++;
+}
+
+void sios_sources_commit(void)
+{
+	writers_transaction--;
+	pthread_mutex_unlock(&writers_list_lock);
 }
 
 void sios_del_source_ctx(struct sios_source_ctx * ctx)
@@ -0,0 +1,1345 @@
+/**
+ *  @file stream.c
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+
+#include "sios.h"
+#include "osc.h"
+#include "stream.h"
+#include "sios_bin.h"
+
+/* records go out as they are published, see sios_bin.h */
+#if __BYTE_ORDER != __LITTLE_ENDIAN
+#error "binary protocol records are sent in host order, clients expect little endian"
+#endif
+
+/* seconds an unreachable listener has to renew its listen */
+#define STREAM_SUSPECT_GRACE	5
+
+/* messages the sender takes from a stream in one go */
+#define STREAM_SEND_BATCH	32
+
+static LIST_HEAD(stream_list);
+static pthread_mutex_t stream_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_unref_cond = PTHREAD_COND_INITIALIZER;
+static uint16_t stream_next_id = 0;
+
+static pthread_once_t sender_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t sender_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sender_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t sender_thread;
+static int sender_running = 0;
+static int sender_work = 0;
+static int sender_halt = 0;
+/* OSC udp listeners are sent to from these, by address family */
+static int sender_fd_inet = -1;
+static int sender_fd_inet6 = -1;
+
+static void * stream_sender(void * arg);
+
+/* -1 leaves the OSC udp listeners of the family to liblo */
+static int stream_sender_socket(int family)
+{
+	int fd;
+
+	fd = socket(family, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+
+	/* liblo's sockets never hear of ICMP errors, ours are worth it */
+	if (sios_streams_watch_errors(fd)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void stream_sender_start(void)
+{
+	sender_fd_inet = stream_sender_socket(AF_INET);
+	sender_fd_inet6 = stream_sender_socket(AF_INET6);
+
+	if (pthread_create(&sender_thread, NULL, stream_sender, NULL))
+		err("Stream", "failed starting stream sender thread");
+	else
+		sender_running = 1;
+}
+
+static struct sios_shm_ring * shm_ring_create(const char * name, size_t record_size,
+					      unsigned int slots)
+{
+	struct sios_shm_ring * ring;
+	int fd;
+
+	ring = (struct sios_shm_ring*)malloc(sizeof(struct sios_shm_ring));
+	if (!ring) {
+		err("Stream", "out of memory while allocating shm ring");
+		return NULL;
+	}
+
+	snprintf(ring->name, SIOS_MAX_NAMESIZE, "%s", name);
+	ring->size = SIOS_SHM_SIZE(slots, record_size);
+
+	/* start from scratch, readers of a previous run see the new magic */
+	shm_unlink(ring->name);
+	fd = shm_open(ring->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		goto err;
+
+	if (ftruncate(fd, ring->size)) {
+		close(fd);
+		shm_unlink(ring->name);
+		goto err;
+	}
+
+	ring->hdr = (struct sios_shm_header*)mmap(NULL, ring->size, PROT_READ | PROT_WRITE,
+						  MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring->hdr == MAP_FAILED) {
+		shm_unlink(ring->name);
+		goto err;
+	}
+
+	/* ftruncate zeroed the ring, magic goes last */
+	ring->hdr->version = SIOS_SHM_VERSION;
+	ring->hdr->record_size = record_size;
+	ring->hdr->slot_size = SIOS_SHM_SLOT_SIZE(record_size);
+	ring->hdr->slots = slots;
+	ring->hdr->head = 0;
+	sios_shm_barrier();
+	ring->hdr->magic = SIOS_SHM_MAGIC;
+
+	return ring;
+
+err:
+	err("Stream", "failed creating shm ring '%s': %s", name, strerror(errno));
+	free(ring);
+	return NULL;
+}
+
+static void shm_ring_destroy(struct sios_shm_ring * ring)
+{
+	munmap(ring->hdr, ring->size);
+	shm_unlink(ring->name);
+	free(ring);
+}
+
+static void shm_ring_append(struct sios_shm_ring * ring, const void * record,
+			    uint64_t timestamp)
+{
+	struct sios_shm_header * hdr = ring->hdr;
+	struct sios_shm_slot * slot;
+	uint64_t n = hdr->head;
+
+	slot = SIOS_SHM_SLOT(hdr, n);
+	slot->seq = 0;
+	sios_shm_barrier();
+	memcpy(SIOS_SHM_DATA(slot), record, hdr->record_size);
+	slot->timestamp = timestamp;
+	sios_shm_barrier();
+	slot->seq = n + 1;
+	sios_shm_barrier();
+	hdr->head = n + 1;
+}
+
+int sios_stream_init(struct sios_stream * stream, struct sios_object * obj,
+		     const char * sub, const char * path, size_t record_size,
+		     sios_stream_encoder encode)
+{
+	if (!stream || !obj || !path || !encode)
+		return -1;
+
+	memset(stream, 0, sizeof(*stream));
+	stream->latest = calloc(1, record_size);
+	if (!stream->latest)
+		return -1;
+	stream->obj = obj;
+	snprintf(stream->sub, SIOS_MAX_NAMESIZE, "%s", sub ? sub : "");
+	snprintf(stream->path, SIOS_MAX_PATHSIZE, "%s", path);
+	stream->record_size = record_size;
+	stream->encode = encode;
+	stream->formats = SIOS_STREAM_FORMAT_MASK(SIOS_STREAM_INT);
+	pthread_mutex_init(&stream->lock, NULL);
+	INIT_LIST_HEAD(&stream->listeners);
+
+	pthread_once(&sender_once, stream_sender_start);
+
+	pthread_mutex_lock(&stream_list_lock);
+	stream->id = ++stream_next_id;
+	list_add_tail(&stream->list, &stream_list);
+	pthread_mutex_unlock(&stream_list_lock);
+
+	return 0;
+}
+
+static inline void stream_msg_put(struct sios_stream_msg * m)
+{
+	if (--m->refs == 0) {
+		if (m->msg)
+			lo_message_free(m->msg);
+		free(m->data);
+		free(m);
+	}
+}
+
+/* only call with the stream lock held */
+static void stream_queue_flush(struct sios_stream_listener * l)
+{
+	while (l->depth) {
+		stream_msg_put(l->queue[l->head]);
+		l->head = (l->head + 1) % l->size;
+		l->depth--;
+	}
+	l->head = 0;
+}
+
+/* only call with the stream lock held */
+static void stream_enqueue(struct sios_stream_listener * l, struct sios_stream_msg * m)
+{
+	if (l->policy == SIOS_STREAM_COALESCE) {
+		l->dropped += l->depth;
+		stream_queue_flush(l);
+	} else if (l->depth == l->size) {
+		if (l->policy == SIOS_STREAM_DROP_NEWEST) {
+			l->dropped++;
+			return;
+		}
+		stream_msg_put(l->queue[l->head]);
+		l->head = (l->head + 1) % l->size;
+		l->depth--;
+		l->dropped++;
+	}
+
+	m->refs++;
+	l->queue[(l->head + l->depth) % l->size] = m;
+	l->depth++;
+	if (l->depth > l->max_depth)
+		l->max_depth = l->depth;
+}
+
+static void stream_listener_destroy(struct sios_stream_listener * l)
+{
+	lo_address_free(l->address);
+	free(l->queue);
+	free(l);
+}
+
+void sios_stream_exit(struct sios_stream * stream)
+{
+	struct sios_stream_listener * l, * tmp;
+
+	/* the sender holds a reference while it works on a stream */
+	pthread_mutex_lock(&stream_list_lock);
+	stream->exiting = 1;
+	while (stream->refs)
+		pthread_cond_wait(&stream_unref_cond, &stream_list_lock);
+	list_del(&stream->list);
+	pthread_mutex_unlock(&stream_list_lock);
+
+	pthread_mutex_lock(&stream->lock);
+	list_for_each_entry_safe(l, tmp, &stream->listeners, listener) {
+		list_del(&l->listener);
+		stream_queue_flush(l);
+		stream_listener_destroy(l);
+	}
+	if (stream->shm) {
+		shm_ring_destroy(stream->shm);
+		stream->shm = NULL;
+	}
+	pthread_mutex_unlock(&stream->lock);
+
+	free(stream->latest);
+	stream->latest = NULL;
+}
+
+/* never with the stream lock held, the module may start its sources */
+static inline void stream_wake(struct sios_stream * stream)
+{
+	if (stream->wake)
+		stream->wake(stream);
+}
+
+int sios_stream_enable_shm(struct sios_stream * stream, unsigned int slots)
+{
+	char name[SIOS_MAX_NAMESIZE], * p;
+	unsigned int n;
+	int len, retval = 0;
+
+	if (!slots)
+		slots = SIOS_SHM_SLOTS;
+	for (n = 1; n < slots; n <<= 1)
+		;
+
+	if (stream->sub[0])
+		len = snprintf(name, SIOS_MAX_NAMESIZE, SIOS_SHM_PREFIX "%s-%s", stream->obj->name, stream->sub);
+	else
+		len = snprintf(name, SIOS_MAX_NAMESIZE, SIOS_SHM_PREFIX "%s", stream->obj->name);
+	if (len >= SIOS_MAX_NAMESIZE) {
+		err("Stream", "shm ring name of %s is too long", stream->path);
+		return -1;
+	}
+	/* shm_open() takes a single leading '/', subs like "3/acc" nest */
+	for (p = name + 1; *p; p++)
+		if (*p == '/')
+			*p = '-';
+
+	pthread_mutex_lock(&stream->lock);
+	if (!stream->shm) {
+		stream->shm = shm_ring_create(name, stream->record_size, n);
+		if (stream->shm)
+			info("Stream", "publishing %s into shm ring '%s' (%u slots)",
+				       stream->path, name, n);
+		else
+			retval = -1;
+	}
+	pthread_mutex_unlock(&stream->lock);
+	if (!retval)
+		stream_wake(stream);
+
+	return retval;
+}
+
+static const struct {
+	const char * name;
+	enum sios_stream_format format;
+} stream_formats[] = {
+	{ "int", SIOS_STREAM_INT },
+	{ "b12", SIOS_STREAM_B12 },
+	{ "b16", SIOS_STREAM_B16 },
+	{ "delta", SIOS_STREAM_DELTA },
+	/* only for binary protocol clients, no stream lists it in formats */
+	{ "binary", SIOS_STREAM_BINARY },
+};
+
+static const char * stream_policies[] = {
+	[SIOS_STREAM_DROP_OLDEST] = "drop-oldest",
+	[SIOS_STREAM_DROP_NEWEST] = "drop-newest",
+	[SIOS_STREAM_COALESCE] = "coalesce",
+};
+
+/**
+ * Options of a listen request.
+ */
+struct stream_options {
+	enum sios_stream_format format;		/**< Wire format */
+	int seq;				/**< Sequence numbers for int messages */
+	int lease;				/**< Lease in seconds, 0 for none */
+	enum sios_stream_policy policy;		/**< Queue overflow policy */
+	unsigned int queue;			/**< Queue length */
+};
+
+static int stream_default_lease = 0;
+
+void sios_streams_set_lease(int seconds)
+{
+	stream_default_lease = seconds > 0 ? seconds : 0;
+}
+
+static inline time_t stream_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/**
+ * Strip the options off the end of a listen request.
+ *
+ * Returns the number of arguments left for the listener's address, or -1
+ * if an option is not supported by the stream.
+ */
+static int stream_parse_options(struct sios_stream * stream, const char * types, lo_arg ** argv,
+				int argc, struct stream_options * opts)
+{
+	unsigned int i;
+	int found;
+
+	opts->format = SIOS_STREAM_INT;
+	opts->seq = 0;
+	opts->lease = stream_default_lease;
+	opts->policy = SIOS_STREAM_DROP_OLDEST;
+	opts->queue = SIOS_STREAM_QUEUE;
+
+	while (argc > 0) {
+		const char * opt = &argv[argc-1]->s;
+
+		/* "lease" <seconds>, "queue" <length> */
+		if (argc >= 2 && (types[argc-1] == 'i' || types[argc-1] == 'f') && types[argc-2] == 's') {
+			const char * name = &argv[argc-2]->s;
+			int n = types[argc-1] == 'i' ? argv[argc-1]->i : (int)argv[argc-1]->f;
+
+			if (!strcmp(name, "lease")) {
+				opts->lease = n > 0 ? n : 0;
+				argc -= 2;
+				continue;
+			} else if (!strcmp(name, "queue")) {
+				opts->queue = n < 1 ? 1 : n > SIOS_STREAM_QUEUE_MAX ? SIOS_STREAM_QUEUE_MAX : n;
+				argc -= 2;
+				continue;
+			}
+		}
+
+		if (types[argc-1] != 's' || opt[0] == '/')
+			break;
+
+		if (!strcmp(opt, "seq")) {
+			opts->seq = 1;
+			argc--;
+			continue;
+		}
+
+		found = 0;
+		for (i=0;i<sizeof(stream_policies)/sizeof(stream_policies[0]);i++) {
+			if (!strcmp(opt, stream_policies[i])) {
+				opts->policy = (enum sios_stream_policy)i;
+				found = 1;
+				break;
+			}
+		}
+		if (found) {
+			argc--;
+			continue;
+		}
+
+		found = 0;
+		for (i=0;i<sizeof(stream_formats)/sizeof(stream_formats[0]);i++) {
+			if (!strcmp(opt, stream_formats[i].name)) {
+				opts->format = stream_formats[i].format;
+				found = 1;
+				break;
+			}
+		}
+
+		/* not an option, e.g. the port of a host/port pair */
+		if (!found)
+			break;
+
+		if (!(stream->formats & SIOS_STREAM_FORMAT_MASK(opts->format))) {
+			warn("Stream", "%s does not support '%s'", stream->path, opt);
+			return -1;
+		}
+		argc--;
+	}
+
+	return argc;
+}
+
+/* only call with the stream lock held */
+static int stream_listener_set(struct sios_stream * stream, struct sios_stream_listener * l,
+			       const struct stream_options * opts)
+{
+	struct sios_stream_msg ** queue;
+
+	if (opts->queue != l->size) {
+		queue = (struct sios_stream_msg**)calloc(opts->queue, sizeof(struct sios_stream_msg*));
+		if (!queue)
+			return -1;
+		stream_queue_flush(l);
+		free(l->queue);
+		l->queue = queue;
+		l->size = opts->queue;
+	}
+
+	l->policy = opts->policy;
+	l->format = opts->format;
+	l->seq = opts->seq;
+	l->expires = opts->lease ? stream_now() + opts->lease : 0;
+	l->suspect = 0;
+
+	/* a new delta listener needs a reference first */
+	if (opts->format == SIOS_STREAM_DELTA)
+		stream->keyframe = 1;
+
+	return 0;
+}
+
+/* OSC and binary subscriptions of a client are separate listeners */
+static inline int stream_listener_match(struct sios_stream_listener * l, lo_address addr,
+					int binary)
+{
+	return (l->format == SIOS_STREAM_BINARY) == binary &&
+	       sios_osc_address_equal(addr, l->address);
+}
+
+/*
+ * Send an OSC udp listener's samples from a sender socket. Numeric
+ * addresses only, a name lookup would stall the receiving thread, liblo
+ * sends to the rest.
+ */
+static void stream_peer_resolve(lo_address addr, struct sios_stream_peer * peer)
+{
+	struct addrinfo hints, * ai;
+
+	peer->fd = -1;
+	if (lo_address_get_protocol(addr) != LO_UDP)
+		return;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+	if (getaddrinfo(lo_address_get_hostname(addr), lo_address_get_port(addr), &hints, &ai))
+		return;
+
+	if (ai->ai_addrlen <= sizeof(peer->addr)) {
+		if (ai->ai_family == AF_INET)
+			peer->fd = sender_fd_inet;
+		else if (ai->ai_family == AF_INET6)
+			peer->fd = sender_fd_inet6;
+		memcpy(&peer->addr, ai->ai_addr, ai->ai_addrlen);
+		peer->len = ai->ai_addrlen;
+	}
+	freeaddrinfo(ai);
+}
+
+/**
+ * Add a listener, peer is NULL for OSC listeners.
+ *
+ * Returns 0 if it was added, 1 if it was listening already and -1 on
+ * failure. The stream only keeps addr in the first case.
+ */
+static int stream_add_listener(struct sios_stream * stream, lo_address addr,
+			       const struct stream_options * opts,
+			       const struct sios_stream_peer * peer)
+{
+	struct sios_stream_listener * l;
+
+	if (!addr)
+		return -1;
+
+	pthread_mutex_lock(&stream->lock);
+	list_for_each_entry(l, &stream->listeners, listener) {
+		if (stream_listener_match(l, addr, peer != NULL)) {
+			/* a repeated listen renews the lease and may switch the format */
+			stream_listener_set(stream, l, opts);
+			pthread_mutex_unlock(&stream->lock);
+			stream_wake(stream);
+			dbg("%s:%s renewed %s (%s)", lo_address_get_hostname(addr),
+			    lo_address_get_port(addr), stream->path,
+			    stream_formats[opts->format].name);
+			return 1;
+		}
+	}
+
+	l = (struct sios_stream_listener*)malloc(sizeof(struct sios_stream_listener));
+	if (!l) {
+		pthread_mutex_unlock(&stream->lock);
+		return -1;
+	}
+
+	memset(l, 0, sizeof(*l));
+	INIT_LIST_HEAD(&l->listener);
+	l->address = addr;
+	if (peer)
+		l->peer = *peer;
+	else
+		stream_peer_resolve(addr, &l->peer);
+	if (stream_listener_set(stream, l, opts)) {
+		pthread_mutex_unlock(&stream->lock);
+		free(l);
+		return -1;
+	}
+	list_add(&l->listener, &stream->listeners);
+	pthread_mutex_unlock(&stream->lock);
+	stream_wake(stream);
+
+	if (opts->lease)
+		info("Stream", "sending %s to: %s:%s (%s%s, %s %u) for %d s", stream->path,
+				lo_address_get_hostname(addr), lo_address_get_port(addr),
+				stream_formats[opts->format].name, opts->seq ? ", seq" : "",
+				stream_policies[opts->policy], opts->queue, opts->lease);
+	else
+		info("Stream", "sending %s to: %s:%s (%s%s, %s %u)", stream->path,
+				lo_address_get_hostname(addr), lo_address_get_port(addr),
+				stream_formats[opts->format].name, opts->seq ? ", seq" : "",
+				stream_policies[opts->policy], opts->queue);
+	return 0;
+}
+
+/* only call with the stream lock held */
+static void stream_free_listener(struct sios_stream * stream, struct sios_stream_listener * l,
+				 const char * why)
+{
+	info("Stream", "%s %s to: %s:%s, %lu sent, %lu failed, %lu dropped", why, stream->path,
+			lo_address_get_hostname(l->address), lo_address_get_port(l->address),
+			l->sent, l->errors, l->dropped);
+	list_del(&l->listener);
+	stream_queue_flush(l);
+	if (l->refs)
+		l->dead = 1;
+	else
+		stream_listener_destroy(l);
+}
+
+static void stream_del_listener(struct sios_stream * stream, lo_address addr, int binary)
+{
+	struct sios_stream_listener * l;
+
+	if (!addr) return;
+
+	pthread_mutex_lock(&stream->lock);
+	list_for_each_entry(l, &stream->listeners, listener) {
+		if (stream_listener_match(l, addr, binary)) {
+			stream_free_listener(stream, l, "stop sending");
+			break;
+		}
+	}
+	pthread_mutex_unlock(&stream->lock);
+}
+
+static int stream_listen_handler(const char *path, const char *types, lo_arg **argv,
+				 int argc, lo_message msg, void *user_data)
+{
+	struct sios_method_desc * desc = (struct sios_method_desc *)user_data;
+	struct sios_stream * stream = (struct sios_stream*)desc->priv;
+	struct stream_options opts;
+	lo_address addr;
+
+	argc = stream_parse_options(stream, types, argv, argc, &opts);
+	if (argc < 0)
+		return -1;
+
+	addr = sios_osc_listener_address(msg, types, argc, argv);
+	if (stream_add_listener(stream, addr, &opts, NULL)) {
+		lo_address_free(addr);
+		return -1;
+	}
+	return 0;
+}
+
+static int stream_silence_handler(const char *path, const char *types, lo_arg **argv,
+				  int argc, lo_message msg, void *user_data)
+{
+	struct sios_method_desc * desc = (struct sios_method_desc *)user_data;
+	struct sios_stream * stream = (struct sios_stream*)desc->priv;
+	struct stream_options opts;
+	lo_address addr;
+
+	/* options are accepted, and ignored, so listen and silence pair up */
+	argc = stream_parse_options(stream, types, argv, argc, &opts);
+	if (argc < 0)
+		return -1;
+
+	addr = sios_osc_listener_address(msg, types, argc, argv);
+	stream_del_listener(stream, addr, 0);
+	lo_address_free(addr);
+	return 0;
+}
+
+static int stream_shm_handler(const char *path, const char *types, lo_arg **argv,
+			      int argc, lo_message msg, void *user_data)
+{
+	struct sios_method_desc * desc = (struct sios_method_desc *)user_data;
+	unsigned int slots = 0;
+
+	if (argc > 0 && types[0] == 'i' && argv[0]->i > 0)
+		slots = argv[0]->i;
+
+	return sios_stream_enable_shm((struct sios_stream*)desc->priv, slots);
+}
+
+static int stream_keyframe_handler(const char *path, const char *types, lo_arg **argv,
+				   int argc, lo_message msg, void *user_data)
+{
+	struct sios_method_desc * desc = (struct sios_method_desc *)user_data;
+	struct sios_stream * stream = (struct sios_stream*)desc->priv;
+
+	pthread_mutex_lock(&stream->lock);
+	stream->keyframe = 1;
+	pthread_mutex_unlock(&stream->lock);
+
+	return 0;
+}
+
+/**
+ * Copy the latest record, without blocking the writer.
+ *
+ * @return The sequence number of the record, 0 if there is none yet
+ */
+static uint32_t stream_read_latest(struct sios_stream * stream, void * record,
+				   uint64_t * timestamp)
+{
+	unsigned int start;
+	uint32_t seq;
+
+	do {
+		start = stream->latest_lock;
+		if (start & 1)
+			continue;
+		sios_shm_barrier();
+		seq = stream->latest_seq;
+		*timestamp = stream->latest_timestamp;
+		memcpy(record, stream->latest, stream->record_size);
+		sios_shm_barrier();
+	} while ((start & 1) || stream->latest_lock != start);
+
+	return seq;
+}
+
+static int stream_get_handler(const char *path, const char *types, lo_arg **argv,
+			      int argc, lo_message msg, void *user_data)
+{
+	struct sios_method_desc * desc = (struct sios_method_desc *)user_data;
+	struct sios_stream * stream = (struct sios_stream*)desc->priv;
+	struct sios_stream_sample sample;
+	struct stream_options opts;
+	lo_message reply;
+	lo_address addr;
+	void * record;
+	int retval = -1;
+
+	argc = stream_parse_options(stream, types, argv, argc, &opts);
+	if (argc < 0)
+		return -1;
+	if (opts.format == SIOS_STREAM_DELTA) {
+		warn("Stream", "get %s: delta needs a subscription", stream->path);
+		return -1;
+	}
+
+	/* the module reads on for a while, the next get has a fresh sample */
+	stream->polled = stream_now();
+	stream_wake(stream);
+
+	record = malloc(stream->record_size);
+	if (!record)
+		return -1;
+
+	sample.seq = stream_read_latest(stream, record, &sample.timestamp);
+	addr = sios_osc_listener_address(msg, types, argc, argv);
+	if (!sample.seq || !addr) {
+		free(record);
+		lo_address_free(addr);
+		return sample.seq ? -1 : 0;
+	}
+
+	reply = lo_message_new();
+	if (opts.seq && opts.format == SIOS_STREAM_INT) {
+		lo_message_add_int32(reply, sample.seq);
+		lo_message_add_timetag(reply, sios_stream_timetag(&sample));
+	}
+	/* not for delta, the encoder leaves the stream alone */
+	if (!stream->encode(stream, record, &sample, opts.format, reply))
+		retval = sios_osc_dispatch_msg(addr, stream->path, reply) < 0 ? -1 : 0;
+
+	lo_message_free(reply);
+	lo_address_free(addr);
+	free(record);
+	return retval;
+}
+
+static int stream_add_method(struct sios_stream * stream, const char * name,
+			     osc_handler handler, const char * descr)
+{
+	struct sios_method_desc * desc;
+	char n[SIOS_MAX_NAMESIZE], m[SIOS_MAX_NAMESIZE];
+	int too_long;
+
+	/* the method's name and address are as long as n and m */
+	if (stream->sub[0])
+		too_long = snprintf(n, SIOS_MAX_NAMESIZE, "%s_%s", stream->sub, name) >= SIOS_MAX_NAMESIZE ||
+			   snprintf(m, SIOS_MAX_NAMESIZE, "%s/%s", stream->sub, name) >= SIOS_MAX_NAMESIZE;
+	else
+		too_long = snprintf(n, SIOS_MAX_NAMESIZE, "%s", name) >= SIOS_MAX_NAMESIZE ||
+			   snprintf(m, SIOS_MAX_NAMESIZE, "%s", name) >= SIOS_MAX_NAMESIZE;
+	if (too_long) {
+		err("Stream", "method %s of %s is too long", name, stream->path);
+		return -1;
+	}
+
+	desc = sios_new_method_desc(n, m, NULL, handler, descr);
+	if (!desc)
+		return -1;
+
+	desc->obj = stream->obj;
+	desc->priv = stream;
+
+	return sios_osc_add_method_desc(desc);
+}
+
+int sios_stream_add_methods(struct sios_stream * stream)
+{
+	int retval = 0;
+
+	retval |= stream_add_method(stream, "listen", stream_listen_handler, "start data transfer");
+	retval |= stream_add_method(stream, "silence", stream_silence_handler, "stop data transfer");
+	retval |= stream_add_method(stream, "get", stream_get_handler, "send the latest sample");
+	retval |= stream_add_method(stream, "shm", stream_shm_handler, "publish into shared memory");
+	if (stream->formats & SIOS_STREAM_FORMAT_MASK(SIOS_STREAM_DELTA))
+		retval |= stream_add_method(stream, "keyframe", stream_keyframe_handler,
+					    "send a keyframe to delta listeners");
+
+	if (retval)
+		warn("Stream", "failed adding methods for %s", stream->path);
+
+	return retval;
+}
+
+/* only call with the stream lock held */
+static void stream_send_failed(struct sios_stream * stream, struct sios_stream_listener * l,
+			       int error)
+{
+	time_t grace;
+
+	l->errors++;
+	if (l->suspect)
+		return;
+
+	switch (error) {
+		case ECONNREFUSED:	/* ICMP port unreachable, or a unix socket without reader */
+		case ENOENT:		/* unix socket path is gone */
+		case EHOSTUNREACH:
+		case ENETUNREACH:
+			break;
+		default:
+			return;
+	}
+
+	/* the client has STREAM_SUSPECT_GRACE seconds to renew its listen */
+	l->suspect = 1;
+	grace = stream_now() + STREAM_SUSPECT_GRACE;
+	if (!l->expires || l->expires > grace)
+		l->expires = grace;
+
+	warn("Stream", "%s:%s unreachable (%s), dropping it from %s unless it listens again",
+		       lo_address_get_hostname(l->address), lo_address_get_port(l->address),
+		       strerror(error), stream->path);
+}
+
+static int stream_peer_equal(const struct sios_stream_peer * peer, const struct sockaddr * to,
+			     socklen_t len)
+{
+	if (peer->addr.ss_family != to->sa_family)
+		return 0;
+
+	if (to->sa_family == AF_INET && len >= sizeof(struct sockaddr_in)) {
+		const struct sockaddr_in * a = (const struct sockaddr_in*)&peer->addr;
+		const struct sockaddr_in * b = (const struct sockaddr_in*)to;
+
+		return a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr;
+	}
+	if (to->sa_family == AF_INET6 && len >= sizeof(struct sockaddr_in6)) {
+		const struct sockaddr_in6 * a = (const struct sockaddr_in6*)&peer->addr;
+		const struct sockaddr_in6 * b = (const struct sockaddr_in6*)to;
+
+		return a->sin6_port == b->sin6_port &&
+		       !memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr));
+	}
+	return 0;
+}
+
+/* mark the listeners sent to from fd at to */
+static void stream_peer_unreachable(int fd, const struct sockaddr * to, socklen_t len, int error)
+{
+	struct sios_stream_listener * l;
+	struct sios_stream * stream;
+
+	pthread_mutex_lock(&stream_list_lock);
+	list_for_each_entry(stream, &stream_list, list) {
+		pthread_mutex_lock(&stream->lock);
+		list_for_each_entry(l, &stream->listeners, listener) {
+			if (l->peer.fd == fd && stream_peer_equal(&l->peer, to, len))
+				stream_send_failed(stream, l, error);
+		}
+		pthread_mutex_unlock(&stream->lock);
+	}
+	pthread_mutex_unlock(&stream_list_lock);
+}
+
+int sios_streams_watch_errors(int fd)
+{
+#ifdef IP_RECVERR
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof(ss);
+	int one = 1;
+
+	if (getsockname(fd, (struct sockaddr*)&ss, &len))
+		return -1;
+	if (ss.ss_family == AF_INET)
+		return setsockopt(fd, IPPROTO_IP, IP_RECVERR, &one, sizeof(one)) ? -1 : 0;
+	if (ss.ss_family == AF_INET6)
+		return setsockopt(fd, IPPROTO_IPV6, IPV6_RECVERR, &one, sizeof(one)) ? -1 : 0;
+#endif
+	return -1;
+}
+
+int sios_streams_read_errors(int fd)
+{
+	int n = 0;
+#ifdef IP_RECVERR
+	char cbuf[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+	struct sock_extended_err ee;
+	struct sockaddr_storage to;
+	struct cmsghdr * cmsg;
+	struct msghdr mh;
+	struct iovec iov;
+	char c;
+
+	while (1) {
+		/* the payload is the packet that bounced, its destination is
+		 * all we need */
+		iov.iov_base = &c;
+		iov.iov_len = sizeof(c);
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_name = &to;
+		mh.msg_namelen = sizeof(to);
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+		mh.msg_control = cbuf;
+		mh.msg_controllen = sizeof(cbuf);
+
+		if (recvmsg(fd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+		n++;
+
+		for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+			if (!(cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) &&
+			    !(cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+				continue;
+			memcpy(&ee, CMSG_DATA(cmsg), sizeof(ee));
+			if (ee.ee_origin == SO_EE_ORIGIN_ICMP || ee.ee_origin == SO_EE_ORIGIN_ICMP6)
+				stream_peer_unreachable(fd, (struct sockaddr*)&to, mh.msg_namelen,
+							ee.ee_errno);
+		}
+	}
+#endif
+	return n;
+}
+
+/*
+ * A socket that queues ICMP errors fails the next send with the latest
+ * one, whatever its destination, the error queue tells whose it was. The
+ * packet did not go out, so try once more.
+ */
+static int stream_peer_send(const struct sios_stream_peer * peer, const void * data,
+			    size_t size)
+{
+	int tries = 2;
+
+	while (sendto(peer->fd, data, size, 0, (const struct sockaddr*)&peer->addr,
+		      peer->len) < 0) {
+		if (--tries == 0 || (errno != ECONNREFUSED && errno != EHOSTUNREACH &&
+				     errno != ENETUNREACH))
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * Send up to STREAM_SEND_BATCH queued samples of a stream, one per
+ * listener, without holding its lock. Served listeners move to the end
+ * of the list, so the next batch starts with the ones left out.
+ * Returns !0 if samples are left.
+ */
+static int stream_send_some(struct sios_stream * stream)
+{
+	struct {
+		struct sios_stream_listener * l;
+		struct sios_stream_msg * m;
+		int failed;
+		int error;
+	} batch[STREAM_SEND_BATCH];
+	struct sios_stream_listener * l;
+	int i, n = 0, more = 0;
+
+	pthread_mutex_lock(&stream->lock);
+	list_for_each_entry(l, &stream->listeners, listener) {
+		if (!l->depth)
+			continue;
+		if (n == STREAM_SEND_BATCH) {
+			more = 1;
+			break;
+		}
+		batch[n].l = l;
+		batch[n].m = l->queue[l->head];
+		l->head = (l->head + 1) % l->size;
+		l->depth--;
+		l->refs++;
+		if (l->depth)
+			more = 1;
+		n++;
+	}
+	for (i=0;i<n;i++)
+		list_move_tail(&batch[i].l->listener, &stream->listeners);
+	pthread_mutex_unlock(&stream->lock);
+
+	for (i=0;i<n;i++) {
+		l = batch[i].l;
+		if (l->peer.fd >= 0 && batch[i].m->data) {
+			batch[i].failed = stream_peer_send(&l->peer, batch[i].m->data,
+							   batch[i].m->size) < 0;
+			batch[i].error = batch[i].failed ? errno : 0;
+		} else {
+			batch[i].failed = sios_osc_dispatch_msg(l->address, stream->path,
+								batch[i].m->msg) < 0;
+			batch[i].error = batch[i].failed ? lo_address_errno(l->address) : 0;
+		}
+	}
+
+	pthread_mutex_lock(&stream->lock);
+	for (i=0;i<n;i++) {
+		l = batch[i].l;
+		if (batch[i].failed)
+			stream_send_failed(stream, l, batch[i].error);
+		else
+			l->sent++;
+		stream_msg_put(batch[i].m);
+		if (--l->refs == 0 && l->dead)
+			stream_listener_destroy(l);
+	}
+	pthread_mutex_unlock(&stream->lock);
+
+	return more;
+}
+
+static void * stream_sender(void * arg)
+{
+	struct sios_stream * stream;
+	int more;
+
+	dbg("stream sender started");
+	pthread_mutex_lock(&sender_lock);
+	while (!sender_halt) {
+		if (!sender_work) {
+			pthread_cond_wait(&sender_cond, &sender_lock);
+			continue;
+		}
+		sender_work = 0;
+		pthread_mutex_unlock(&sender_lock);
+
+		/* round robin over all listeners until the queues are empty. A
+		 * reference keeps a stream in the list while it is sent without
+		 * the list lock, which listen and silence need. */
+		do {
+			more = 0;
+			pthread_mutex_lock(&stream_list_lock);
+			list_for_each_entry(stream, &stream_list, list) {
+				if (stream->exiting)
+					continue;
+				stream->refs++;
+				pthread_mutex_unlock(&stream_list_lock);
+				more |= stream_send_some(stream);
+				pthread_mutex_lock(&stream_list_lock);
+				if (--stream->refs == 0 && stream->exiting)
+					pthread_cond_broadcast(&stream_unref_cond);
+			}
+			pthread_mutex_unlock(&stream_list_lock);
+
+			if (sender_fd_inet >= 0)
+				sios_streams_read_errors(sender_fd_inet);
+			if (sender_fd_inet6 >= 0)
+				sios_streams_read_errors(sender_fd_inet6);
+		} while (more && !sender_halt);
+
+		pthread_mutex_lock(&sender_lock);
+	}
+	pthread_mutex_unlock(&sender_lock);
+
+	dbg("stream sender stopped");
+	return NULL;
+}
+
+static struct sios_stream_msg * stream_encode(struct sios_stream * stream, const void * record,
+					      enum sios_stream_format format, int seq)
+{
+	struct sios_stream_sample sample = { stream->seq, stream->timestamp };
+	struct sios_stream_msg * m;
+
+	m = (struct sios_stream_msg*)malloc(sizeof(struct sios_stream_msg));
+	if (!m)
+		return NULL;
+
+	m->refs = 1;
+	m->data = NULL;
+	m->msg = NULL;
+
+	if (format == SIOS_STREAM_BINARY) {
+		struct sios_bin_header * hdr;
+
+		/* the record is the payload, no encoder involved */
+		m->size = sizeof(struct sios_bin_header) + stream->record_size;
+		m->data = malloc(m->size);
+		if (!m->data) {
+			free(m);
+			return NULL;
+		}
+		hdr = (struct sios_bin_header*)m->data;
+		sios_bin_header_init(hdr, SIOS_BIN_SAMPLE, stream->id, stream->record_size);
+		hdr->seq = htole32(sample.seq);
+		hdr->timestamp = htole64(sample.timestamp);
+		memcpy(hdr + 1, record, stream->record_size);
+		return m;
+	}
+
+	m->msg = lo_message_new();
+	if (!m->msg) {
+		free(m);
+		return NULL;
+	}
+
+	if (seq) {
+		lo_message_add_int32(m->msg, sample.seq);
+		lo_message_add_timetag(m->msg, sios_stream_timetag(&sample));
+	}
+
+	if (stream->encode(stream, record, &sample, format, m->msg)) {
+		stream_msg_put(m);
+		return NULL;
+	}
+
+	/* serialised once for all the listeners sent to from our sockets,
+	 * liblo sends the message itself to the others */
+	m->data = lo_message_serialise(m->msg, stream->path, NULL, &m->size);
+
+	return m;
+}
+
+static pthread_once_t stream_clock_once = PTHREAD_ONCE_INIT;
+static int64_t stream_clock_offset;
+
+static void stream_clock_init(void)
+{
+	struct timespec ts;
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	stream_clock_offset = ((int64_t)now.tv_sec * 1000000 + now.tv_usec) -
+			      ((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+uint64_t sios_stream_clock(void)
+{
+	struct timespec ts;
+
+	pthread_once(&stream_clock_once, stream_clock_init);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 + stream_clock_offset;
+}
+
+void sios_stream_publish(struct sios_stream * stream, const void * record)
+{
+	sios_stream_publish_at(stream, record, sios_stream_clock());
+}
+
+void sios_stream_publish_at(struct sios_stream * stream, const void * record, uint64_t timestamp)
+{
+	struct sios_stream_msg * msgs[SIOS_STREAM_FORMATS][2], * m;
+	struct sios_stream_listener * l;
+	int i, seq, queued = 0;
+
+	pthread_mutex_lock(&stream->lock);
+
+	stream->seq++;
+	stream->timestamp = timestamp;
+
+	/* seqlock write, get never waits for us and we never wait for get */
+	stream->latest_lock++;
+	sios_shm_barrier();
+	memcpy(stream->latest, record, stream->record_size);
+	stream->latest_seq = stream->seq;
+	stream->latest_timestamp = stream->timestamp;
+	sios_shm_barrier();
+	stream->latest_lock++;
+
+	if (!list_empty(&stream->listeners)) {
+		/* encoded once per variant, whatever the number of listeners */
+		memset(msgs, 0, sizeof(msgs));
+		list_for_each_entry(l, &stream->listeners, listener) {
+			/* blob formats carry the sequence number already */
+			seq = l->seq && l->format == SIOS_STREAM_INT;
+			m = msgs[l->format][seq];
+			if (!m)
+				m = msgs[l->format][seq] = stream_encode(stream, record, l->format, seq);
+			if (!m)
+				continue;
+
+			stream_enqueue(l, m);
+			queued = 1;
+		}
+		for (i=0;i<SIOS_STREAM_FORMATS;i++) {
+			if (msgs[i][0])
+				stream_msg_put(msgs[i][0]);
+			if (msgs[i][1])
+				stream_msg_put(msgs[i][1]);
+		}
+	}
+
+	if (stream->shm)
+		shm_ring_append(stream->shm, record, stream->timestamp);
+
+	pthread_mutex_unlock(&stream->lock);
+
+	if (queued) {
+		pthread_mutex_lock(&sender_lock);
+		sender_work = 1;
+		pthread_cond_signal(&sender_cond);
+		pthread_mutex_unlock(&sender_lock);
+	}
+}
+
+/* a liblo address for the listener's bookkeeping, sends go to peer */
+static lo_address stream_peer_address(const struct sios_stream_peer * peer)
+{
+	char host[NI_MAXHOST], port[NI_MAXSERV];
+
+	if (getnameinfo((const struct sockaddr*)&peer->addr, peer->len, host, sizeof(host),
+			port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV))
+		return NULL;
+
+	return lo_address_new(host, port);
+}
+
+int sios_streams_bin_listen(const char * path, const struct sios_stream_peer * peer,
+			    unsigned int lease, unsigned int queue, enum sios_stream_policy policy)
+{
+	struct stream_options opts;
+	struct sios_stream * stream;
+	lo_address addr;
+	int retval = -1;
+
+	opts.format = SIOS_STREAM_BINARY;
+	opts.seq = 0;
+	opts.lease = lease ? (int)lease : stream_default_lease;
+	opts.policy = policy;
+	opts.queue = !queue ? SIOS_STREAM_QUEUE : queue > SIOS_STREAM_QUEUE_MAX ?
+		     SIOS_STREAM_QUEUE_MAX : queue;
+
+	pthread_mutex_lock(&stream_list_lock);
+	list_for_each_entry(stream, &stream_list, list) {
+		if (strcmp(stream->path, path))
+			continue;
+
+		addr = stream_peer_address(peer);
+		switch (stream_add_listener(stream, addr, &opts, peer)) {
+			case 1:
+				lo_address_free(addr);
+				/* fall through */
+			case 0:
+				retval = stream->id;
+				break;
+			default:
+				lo_address_free(addr);
+				break;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&stream_list_lock);
+
+	return retval;
+}
+
+void sios_streams_bin_silence(unsigned int id, const struct sios_stream_peer * peer)
+{
+	struct sios_stream * stream;
+	lo_address addr;
+
+	addr = stream_peer_address(peer);
+	if (!addr)
+		return;
+
+	pthread_mutex_lock(&stream_list_lock);
+	list_for_each_entry(stream, &stream_list, list) {
+		if (stream->id == id) {
+			stream_del_listener(stream, addr, 1);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&stream_list_lock);
+
+	lo_address_free(addr);
+}
+
+void sios_streams_reap(void)
+{
+	struct sios_stream_listener * l, * tmp;
+	struct sios_stream * stream;
+	time_t now = stream_now();
+
+	pthread_mutex_lock(&stream_list_lock);
+	list_for_each_entry(stream, &stream_list, list) {
+		pthread_mutex_lock(&stream->lock);
+		list_for_each_entry_safe(l, tmp, &stream->listeners, listener) {
+			if (l->expires && l->expires <= now)
+				stream_free_listener(stream, l, l->suspect ?
+						     "unreachable, stop sending" :
+						     "lease expired, stop sending");
+		}
+		pthread_mutex_unlock(&stream->lock);
+	}
+	pthread_mutex_unlock(&stream_list_lock);
+}
+
+void sios_streams_print_stats(void)
+{
+	struct sios_stream_listener * l;
+	struct sios_stream * stream;
+
+	pthread_mutex_lock(&stream_list_lock);
+	list_for_each_entry(stream, &stream_list, list) {
+		pthread_mutex_lock(&stream->lock);
+		info("Stream", "%s: %u samples", stream->path, stream->seq);
+		list_for_each_entry(l, &stream->listeners, listener)
+			info("Stream", "  %s:%s (%s): %lu sent, %lu failed, %lu dropped (%s), "
+				       "queue %u/%u, max %u",
+				       lo_address_get_hostname(l->address),
+				       lo_address_get_port(l->address),
+				       stream_formats[l->format].name, l->sent, l->errors,
+				       l->dropped, stream_policies[l->policy],
+				       l->depth, l->size, l->max_depth);
+		pthread_mutex_unlock(&stream->lock);
+	}
+	pthread_mutex_unlock(&stream_list_lock);
+}
+
+void sios_streams_exit(void)
+{
+	if (!sender_running)
+		return;
+
+	pthread_mutex_lock(&sender_lock);
+	sender_halt = 1;
+	pthread_cond_signal(&sender_cond);
+	pthread_mutex_unlock(&sender_lock);
+
+	pthread_join(sender_thread, NULL);
+	sender_running = 0;
+
+	if (sender_fd_inet >= 0)
+		close(sender_fd_inet);
+	if (sender_fd_inet6 >= 0)
+		close(sender_fd_inet6);
+	sender_fd_inet = sender_fd_inet6 = -1;
+}
@@ -0,0 +1,353 @@
+/**
+ *  @file stream.h
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <sys/socket.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "sios.h"
+#include "osc.h"
+#include "sios_shm.h"
+
+/* default number of slots of a shared memory ring */
+#define SIOS_SHM_SLOTS		1024
+
+/* seconds a get keeps a stream active, see sios_stream_active() */
+#define SIOS_STREAM_POLL_GRACE	10
+
+/**
+ * Wire formats a listener can ask for, see the <i>listen</i> options.
+ */
+enum sios_stream_format {
+	SIOS_STREAM_INT = 0,		/**< One int32 argument per value, the default */
+	SIOS_STREAM_B12,		/**< Frame counter, timetag and a blob of packed 12 bit values */
+	SIOS_STREAM_B16,		/**< Frame counter, timetag and a blob of 16 bit values */
+	SIOS_STREAM_DELTA,		/**< Frame counter, keyframe number, timetag and a delta blob */
+	SIOS_STREAM_BINARY,		/**< Binary protocol datagram, see sios_bin.h */
+	SIOS_STREAM_FORMATS,
+};
+
+#define SIOS_STREAM_FORMAT_MASK(_format)	(1U << (_format))
+
+struct sios_stream;
+
+/**
+ * Sequence number and capture time of the sample being encoded.
+ */
+struct sios_stream_sample {
+	uint32_t seq;				/**< Sequence number */
+	uint64_t timestamp;			/**< Capture time, microseconds since the epoch */
+};
+
+/**
+ * Add the OSC arguments of a record in the given format to msg.
+ *
+ * Called with the stream's lock held when publishing. <i>get</i> calls
+ * it without, never for SIOS_STREAM_DELTA, so only delta encoders may
+ * touch the stream's state.
+ *
+ * @return 0 on success, !0 if the record can not be encoded
+ */
+typedef int (*sios_stream_encoder)(struct sios_stream * stream, const void * record,
+				   const struct sios_stream_sample * sample,
+				   enum sios_stream_format format, lo_message msg);
+
+/**
+ * What to do with a sample for a listener whose queue is full.
+ */
+enum sios_stream_policy {
+	SIOS_STREAM_DROP_OLDEST = 0,	/**< Make room by dropping the oldest queued sample */
+	SIOS_STREAM_DROP_NEWEST,	/**< Drop the new sample */
+	SIOS_STREAM_COALESCE,		/**< Only ever queue the latest sample */
+};
+
+/* default and maximum queue length of a listener */
+#define SIOS_STREAM_QUEUE	64
+#define SIOS_STREAM_QUEUE_MAX	1024
+
+/**
+ * An encoded sample, shared by the queues of all listeners of a format.
+ */
+struct sios_stream_msg {
+	lo_message msg;				/**< The message, NULL for a binary one */
+	void * data;				/**< The datagram, serialised msg for an OSC one */
+	size_t size;				/**< Its length */
+	int refs;				/**< References, protected by the stream's lock */
+};
+
+/**
+ * Where the samples of a udp listener go.
+ *
+ * Binary listeners are sent to from the binary port, OSC listeners from
+ * the sender's own socket, whose ICMP errors point out unreachable ones.
+ */
+struct sios_stream_peer {
+	int fd;					/**< Socket to send from, -1 to leave it to liblo */
+	struct sockaddr_storage addr;		/**< The client */
+	socklen_t len;				/**< Length of addr */
+};
+
+/**
+ * An OSC or binary protocol listener of a stream.
+ *
+ * Samples are queued for the core's stream sender thread, a slow
+ * listener only fills its own queue.
+ */
+struct sios_stream_listener {
+	lo_address address;			/**< Where samples are sent to */
+	enum sios_stream_format format;		/**< Requested wire format */
+	int seq;				/**< Prefix int messages with sequence number and timetag */
+	time_t expires;				/**< End of the lease, CLOCK_MONOTONIC s, 0 for none */
+	int suspect;				/**< Sends failed as unreachable */
+	struct sios_stream_peer peer;		/**< Udp listeners only */
+
+	enum sios_stream_policy policy;		/**< Overflow policy of the queue */
+	struct sios_stream_msg ** queue;	/**< Queued samples, a ring */
+	unsigned int size;			/**< Length of queue */
+	unsigned int head;			/**< Oldest queued sample */
+	unsigned int depth;			/**< Number of queued samples */
+	unsigned int max_depth;			/**< Highest depth seen */
+
+	unsigned long sent;			/**< Messages sent */
+	unsigned long errors;			/**< Messages that failed to send */
+	unsigned long dropped;			/**< Samples dropped by the overflow policy */
+
+	int refs;				/**< Held by the sender while sending */
+	int dead;				/**< Removed, the sender frees it */
+	struct list_head listener;		/**< list_head entry for the stream's listeners */
+};
+
+/**
+ * A shared memory ring written by a stream.
+ */
+struct sios_shm_ring {
+	char name[SIOS_MAX_NAMESIZE];	/**< shm_open() name */
+	size_t size;			/**< Size of the mapping */
+	struct sios_shm_header * hdr;	/**< The mapped ring */
+};
+
+/**
+ * A stream of sensor samples published by a module.
+ *
+ * Modules hand every sample to sios_stream_publish() as a fixed layout
+ * record. The stream queues it for its OSC listeners, encoded once per wire
+ * format by the module's encoder, and for binary protocol listeners, who
+ * get the record as is. It appends it to the shared memory ring
+ * when local clients asked for one. The module never waits for a socket.
+ * The latest record is kept for clients that poll with <i>get</i>.
+ * Modules that stop reading idle sensors set <i>wake</i> to restart them
+ * on a listen, shm or get request, see sios_stream_active().
+ */
+struct sios_stream {
+	struct sios_object * obj;		/**< The owning sios_object */
+	char sub[SIOS_MAX_NAMESIZE];		/**< Method prefix, e.g. "acc", may be empty */
+	char path[SIOS_MAX_PATHSIZE];		/**< OSC address samples are sent to */
+	size_t record_size;			/**< Size of a record */
+	sios_stream_encoder encode;		/**< Turns a record into an OSC message */
+	unsigned int formats;			/**< Supported formats, SIOS_STREAM_FORMAT_MASK()s */
+	uint16_t id;				/**< Binary protocol stream id */
+	void (*wake)(struct sios_stream *);	/**< Called when a consumer may have appeared, NULL for none */
+	volatile time_t polled;			/**< Last get, CLOCK_MONOTONIC s, 0 for never, not locked */
+	int refs;				/**< Held by the sender, under the list lock of all streams */
+	int exiting;				/**< sios_stream_exit() waits for refs, same lock */
+
+	pthread_mutex_t lock;			/**< Protects everything below */
+	struct list_head listeners;		/**< OSC listeners, struct sios_stream_listener */
+	struct sios_shm_ring * shm;		/**< Shared memory ring, NULL if none */
+	uint32_t seq;				/**< Sequence number of the sample being published */
+	uint64_t timestamp;			/**< Its capture time, microseconds since the epoch */
+	int keyframe;				/**< A listener asked for a keyframe */
+	void * priv;				/**< private data */
+	struct list_head list;			/**< list_head entry for the list of all streams */
+
+	/* latest value, written under lock, read locklessly by get */
+	volatile unsigned int latest_lock;	/**< Seqlock count, odd while writing */
+	uint32_t latest_seq;			/**< Sequence number of the latest sample, 0 for none */
+	uint64_t latest_timestamp;		/**< Its capture time */
+	void * latest;				/**< The latest record */
+};
+
+/**
+ * Initialize a stream.
+ *
+ * Only SIOS_STREAM_INT is supported, modules that encode more formats
+ * add them to <i>formats</i> afterwards.
+ *
+ * @param stream The stream
+ * @param obj The owning object
+ * @param sub Method prefix of the stream, NULL or "" for none
+ * @param path OSC address samples are sent to
+ * @param record_size Size of the records passed to sios_stream_publish()
+ * @param encode Encoder for OSC listeners
+ * @return 0 on success, !0 on failure
+ */
+int sios_stream_init(struct sios_stream * stream, struct sios_object * obj,
+		     const char * sub, const char * path, size_t record_size,
+		     sios_stream_encoder encode);
+
+/**
+ * Export the <i>listen</i>, <i>silence</i>, <i>get</i> and <i>shm</i>
+ * methods of a stream.
+ *
+ * The methods are added under the stream's sub address,
+ * e.g. <code>acc/listen</code>. <i>listen</i> takes the usual optional
+ * host and port followed by option strings: "int", "b12", "b16" or
+ * "delta" select the wire format. "seq" prefixes int messages with the
+ * sample's sequence number and capture timetag, which the other formats
+ * always carry. "lease" followed by a number of seconds limits the
+ * subscription, repeating the listen renews it. "queue" followed by a
+ * number sets the listener's queue length, "drop-oldest" (the default),
+ * "drop-newest" or "coalesce" what happens when it is full. Streams
+ * supporting delta also get a <i>keyframe</i> method, see frame.h.
+ * <i>get</i> sends the latest sample once, it takes the same address
+ * arguments and the format options except delta. It keeps the stream
+ * active for SIOS_STREAM_POLL_GRACE seconds. The first get after the
+ * stream was idle wakes the module and may answer with a sample from
+ * before, "seq" tells its capture time.
+ */
+int sios_stream_add_methods(struct sios_stream * stream);
+
+/**
+ * Drop all listeners and remove the shared memory ring.
+ */
+void sios_stream_exit(struct sios_stream * stream);
+
+/**
+ * Create the stream's shared memory ring, if it has none yet.
+ *
+ * @param slots Ring size, rounded up to a power of two, 0 for the default
+ */
+int sios_stream_enable_shm(struct sios_stream * stream, unsigned int slots);
+
+/**
+ * Tell if samples are sent anywhere, or were polled with <i>get</i>
+ * within SIOS_STREAM_POLL_GRACE seconds.
+ *
+ * Modules that read idle sensors anyway skip other work for idle
+ * streams with it, modules that stop idle sensors only publish while it
+ * holds, so the latest value may be old. It is not locked.
+ */
+static inline int sios_stream_active(struct sios_stream * stream)
+{
+	struct timespec ts;
+	time_t polled;
+
+	if (!list_empty(&stream->listeners) || stream->shm)
+		return 1;
+	polled = stream->polled;
+	if (!polled)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec - polled < SIOS_STREAM_POLL_GRACE;
+}
+
+/**
+ * Capture time of a sample as an OSC timetag, for encoders.
+ */
+static inline lo_timetag sios_stream_timetag(const struct sios_stream_sample * sample)
+{
+	lo_timetag tt;
+
+	tt.sec = (uint32_t)(sample->timestamp / 1000000) + 2208988800UL;
+	tt.frac = (uint32_t)(((sample->timestamp % 1000000) << 32) / 1000000);
+	return tt;
+}
+
+/**
+ * Clock of sample timestamps, microseconds since the epoch.
+ *
+ * It runs on CLOCK_MONOTONIC from the wall clock time it was first read
+ * at, so intervals between samples stay exact when the wall clock is set.
+ */
+uint64_t sios_stream_clock(void);
+
+/**
+ * Publish a sample to all consumers of the stream, timestamped now.
+ *
+ * @param record record_size bytes describing the sample
+ */
+void sios_stream_publish(struct sios_stream * stream, const void * record);
+
+/**
+ * Publish a sample captured earlier.
+ *
+ * @param timestamp Capture time from sios_stream_clock()
+ */
+void sios_stream_publish_at(struct sios_stream * stream, const void * record, uint64_t timestamp);
+
+/**
+ * Set the lease of listen requests that do not ask for one, in seconds,
+ * 0 for none.
+ */
+void sios_streams_set_lease(int seconds);
+
+/**
+ * Subscribe a binary protocol client to the stream with the given OSC
+ * path, or renew its subscription.
+ *
+ * @param lease Seconds, 0 for the default lease
+ * @param queue Queue length, 0 for the default
+ * @return The stream's id, -1 if there is no such stream
+ */
+int sios_streams_bin_listen(const char * path, const struct sios_stream_peer * peer,
+			    unsigned int lease, unsigned int queue, enum sios_stream_policy policy);
+
+/**
+ * Unsubscribe a binary protocol client from a stream.
+ */
+void sios_streams_bin_silence(unsigned int id, const struct sios_stream_peer * peer);
+
+/**
+ * Have the kernel queue the ICMP errors of a udp socket that sends
+ * stream samples, see sios_streams_read_errors().
+ *
+ * @return 0 on success, -1 if the platform does not report them
+ */
+int sios_streams_watch_errors(int fd);
+
+/**
+ * Read the queued ICMP errors of a socket set up with
+ * sios_streams_watch_errors(), and mark the listeners sent to from it
+ * that turned out unreachable.
+ *
+ * @return The number of errors read
+ */
+int sios_streams_read_errors(int fd);
+
+/**
+ * Drop the listeners whose lease ran out, or that turned out
+ * unreachable and did not renew. The core calls it every second.
+ */
+void sios_streams_reap(void);
+
+/**
+ * Log the send and queue counters of the listeners of all streams.
+ */
+void sios_streams_print_stats(void);
+
+/**
+ * Stop the stream sender thread, after the modules are gone.
+ */
+void sios_streams_exit(void);
+
+#endif /* STREAM_H */
@@ -0,0 +1,297 @@
+/**
+ *  @file stream_recv.c
+ *
+ *  Lightweight stream receiver reporting loss and reordering. It
+ *  subscribes to a stream with the "seq" option, or listens on a port for
+ *  an existing subscription, and reads the sequence number and capture
+ *  timetag that start every message of the seq, b12, b16 and delta
+ *  formats. Every interval it prints what arrived, what went missing or
+ *  arrived out of order, and the transit time, which only means something
+ *  with synchronized clocks.
+ *
+ *  	streamrecv -h board -P 7770 -s /sios/sensors/accmag/acc
+ *
+ *  Raise -r until loss stops at a given rate to size socket buffers. It
+ *  does not need liblo.
+ *
+ *  Copyright (C) 2006 V2_lab, Simon de Bakker <simon@v2.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#define NTP_UNIX_OFFSET		2208988800UL
+#define MAX_PACKET		4096
+
+#define OSC_PAD(_n)		(((_n) + 3) & ~3)
+
+struct recv_stats {
+	unsigned long received;
+	unsigned long lost;
+	unsigned long reordered;
+	unsigned long duplicates;
+	unsigned long unknown;		/* messages without sequence number */
+	double transit_sum;
+	double transit_max;
+};
+
+static volatile int halt = 0;
+
+static void handle_signal(int sig)
+{
+	halt = 1;
+}
+
+static double now_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static uint32_t get32(const unsigned char * p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* a message with a string argument, or none */
+static int osc_build(unsigned char * buf, const char * path, const char * arg)
+{
+	int len, n;
+
+	memset(buf, 0, MAX_PACKET);
+	len = strlen(path);
+	memcpy(buf, path, len);
+	len = OSC_PAD(len + 1);
+
+	memcpy(buf + len, arg ? ",s" : ",", arg ? 2 : 1);
+	len += 4;
+
+	if (arg) {
+		n = strlen(arg);
+		memcpy(buf + len, arg, n);
+		len += OSC_PAD(n + 1);
+	}
+	return len;
+}
+
+/**
+ * Find the sequence number and capture time, microseconds since the
+ * epoch, of a message starting with ",it".
+ */
+static int osc_parse_seq(const unsigned char * buf, int len, uint32_t * seq, double * stamp)
+{
+	const unsigned char * end = buf + len, * p = buf;
+
+	/* skip path */
+	p += OSC_PAD(strnlen((const char*)p, len) + 1);
+	if (p >= end || p[0] != ',' || p[1] != 'i' || p[2] != 't')
+		return -1;
+
+	/* skip typetag */
+	p += OSC_PAD(strnlen((const char*)p, end - p) + 1);
+	if (p + 12 > end)
+		return -1;
+
+	*seq = get32(p);
+	*stamp = (get32(p + 4) - (double)NTP_UNIX_OFFSET) * 1e6 + get32(p + 8) / 4294.967296;
+	return 0;
+}
+
+static void print_stats(struct recv_stats * s, double seconds)
+{
+	printf("%8.1f msg/s %8lu recv %6lu lost (%5.2f%%) %6lu reordered %4lu dup",
+	       s->received / seconds, s->received, s->lost,
+	       s->received + s->lost ? 100.0 * s->lost / (s->received + s->lost) : 0.0,
+	       s->reordered, s->duplicates);
+	if (s->received)
+		printf("   transit %.0f/%.0f usec", s->transit_sum / s->received, s->transit_max);
+	if (s->unknown)
+		printf("   %lu without seq", s->unknown);
+	printf("\n");
+	fflush(stdout);
+}
+
+static void usage(const char * name)
+{
+	printf("usage: %s [-h host] [-P sios port] [-s stream] [-p local port] [-r rcvbuf] [-i interval]\n"
+	       "  -s subscribes to the stream, e.g. /sios/sensors/matrix, with host and port.\n"
+	       "  Without it, run listen ... seq for the local port by hand.\n", name);
+}
+
+int main(int argc, char * argv[])
+{
+	unsigned char buf[MAX_PACKET];
+	struct sockaddr_in local, sios;
+	struct recv_stats stats;
+	struct timeval timeout;
+	struct hostent * he;
+	const char * host = "127.0.0.1", * stream = NULL;
+	char path[256];
+	int sios_port = 0, port = 0, rcvbuf = 0, interval = 1;
+	int fd, c, len, have_seq = 0;
+	uint32_t seq, expected = 0;
+	double stamp, transit, start, now;
+	socklen_t slen;
+
+	while ((c = getopt(argc, argv, "h:P:s:p:r:i:")) >= 0) {
+		switch (c) {
+			case 'h':
+				host = optarg;
+				break;
+			case 'P':
+				sios_port = atoi(optarg);
+				break;
+			case 's':
+				stream = optarg;
+				break;
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'r':
+				rcvbuf = atoi(optarg);
+				break;
+			case 'i':
+				interval = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if ((stream && sios_port <= 0) || (!stream && port <= 0) || interval <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return 1;
+	}
+
+	if (rcvbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)))
+		perror("SO_RCVBUF");
+	slen = sizeof(rcvbuf);
+	getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &slen);
+
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	local.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr*)&local, sizeof(local))) {
+		perror("bind");
+		return 1;
+	}
+	slen = sizeof(local);
+	getsockname(fd, (struct sockaddr*)&local, &slen);
+
+	if (stream) {
+		he = gethostbyname(host);
+		if (!he) {
+			fprintf(stderr, "unknown host %s\n", host);
+			return 1;
+		}
+		memset(&sios, 0, sizeof(sios));
+		sios.sin_family = AF_INET;
+		memcpy(&sios.sin_addr, he->h_addr, sizeof(sios.sin_addr));
+		sios.sin_port = htons(sios_port);
+
+		/* without address arguments sios answers the sending socket */
+		snprintf(path, sizeof(path), "%s/listen", stream);
+		len = osc_build(buf, path, "seq");
+		if (sendto(fd, buf, len, 0, (struct sockaddr*)&sios, sizeof(sios)) < 0) {
+			perror("sendto");
+			return 1;
+		}
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	printf("receiving on port %d, %d byte receive buffer\n", ntohs(local.sin_port), rcvbuf);
+	memset(&stats, 0, sizeof(stats));
+	start = now_usec();
+
+	while (!halt) {
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 100000;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		len = recv(fd, buf, sizeof(buf), 0);
+		now = now_usec();
+
+		if (len > 0) {
+			if (osc_parse_seq(buf, len, &seq, &stamp)) {
+				stats.unknown++;
+			} else {
+				stats.received++;
+				transit = now - stamp;
+				stats.transit_sum += transit;
+				if (transit > stats.transit_max)
+					stats.transit_max = transit;
+
+				if (!have_seq || (int32_t)(seq - expected) >= 0) {
+					/* new samples, anything skipped is lost for now */
+					if (have_seq)
+						stats.lost += seq - expected;
+					expected = seq + 1;
+					have_seq = 1;
+				} else if ((int32_t)(seq - expected) < -1) {
+					/* older than the last one: it was counted lost */
+					stats.reordered++;
+					if (stats.lost)
+						stats.lost--;
+				} else {
+					stats.duplicates++;
+				}
+			}
+		} else if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			perror("recv");
+			break;
+		}
+
+		if (now - start >= interval * 1e6) {
+			print_stats(&stats, (now - start) / 1e6);
+			memset(&stats, 0, sizeof(stats));
+			start = now;
+		}
+	}
+
+	if (stream) {
+		snprintf(path, sizeof(path), "%s/silence", stream);
+		len = osc_build(buf, path, NULL);
+		sendto(fd, buf, len, 0, (struct sockaddr*)&sios, sizeof(sios));
+	}
+
+	close(fd);
+	return 0;
+}